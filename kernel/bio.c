@@ -12,6 +12,11 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers come from a slab cache. There are NBUF of them to
+// begin with; when every buffer is in use, bget() allocates
+// another, and brelse() frees such extra buffers again when
+// they are released.
 
 
 #include "types.h"
@@ -23,9 +28,12 @@
 #include "fs.h"
 #include "buf.h"
 
+static struct buf* balloc(void);
+
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct kmem_cache *cache;
+  int nbuf;            // buffers allocated
 
   // Linked list of all buffers, through prev/next.
   // Sorted by how recently the buffer was used.
@@ -36,20 +44,33 @@ struct {
 void
 binit(void)
 {
-  struct buf *b;
-
   initlock(&bcache.lock, "bcache");
-
-  // Create linked list of buffers
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf));
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+  for(int i = 0; i < NBUF; i++)
+    if(balloc() == 0)
+      panic("binit");
+}
+
+// Allocate a buffer and put it at the head of the list.
+// Returns 0 if out of memory. Caller must hold bcache.lock,
+// except during binit().
+static struct buf*
+balloc(void)
+{
+  struct buf *b;
+
+  if((b = kmem_cache_alloc(bcache.cache)) == 0)
+    return 0;
+  initsleeplock(&b->lock, "buffer");
+  b->disk = 0;
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+  bcache.nbuf++;
+  return b;
 }
 
 // Look through buffer cache for block on device dev.
@@ -73,19 +94,20 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
-  }
-  panic("bget: no buffers");
+  // Recycle the least recently used (LRU) unused buffer,
+  // or allocate another if every buffer is in use.
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev)
+    if(b->refcnt == 0)
+      break;
+  if(b == &bcache.head && (b = balloc()) == 0)
+    panic("bget: no buffers");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -123,7 +145,13 @@ brelse(struct buf *b)
 
   acquire(&bcache.lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
+  if (b->refcnt == 0 && bcache.nbuf > NBUF) {
+    // an extra buffer; free it.
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    bcache.nbuf--;
+    kmem_cache_free(bcache.cache, b);
+  } else if (b->refcnt == 0) {
     // no one is waiting for it.
     b->next->prev = b->prev;
     b->prev->next = b->next;
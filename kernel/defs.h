@@ -2,12 +2,14 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -23,7 +25,7 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
-int             exec(char*, char**);
+int             exec(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -62,7 +64,16 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void            kfreemany(void **, int);
+void*           kalloc_zeroed(void);
+int             kzerofill(void);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void            kref(void *);
+int             krefcount(void *);
 void            kinit(void);
+void            kallocdump(void);
+int             kfreecount(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -71,6 +82,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -85,13 +97,27 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct file**);
+int             vfork(void);
+void            vforkreturn(struct proc*, uint64, struct vma*);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+void            reaperinit(void);
+void            reapwait(void);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
+int             setpriority(int, int);
+int             setscheduler(int, int, int);
+int             setaffinity(int, uint64);
+int             getaffinity(int, uint64*);
+void            priowait(struct sleeplock*);
+void            priohold(struct sleeplock*);
+void            priorelease(struct sleeplock*);
+int             sleepprio(void*);
+int             schedtick(void);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -102,10 +128,13 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            wakeupone(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+pagetable_t     procstop(int);
+void            procresume(pagetable_t, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -118,6 +147,21 @@ void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
+// shm.c
+void            shminit(void);
+int             shmget(int, uint64, int);
+uint64          shmattach(int);
+void*           shmpage(int, uint);
+void            shmdup(int);
+void            shmput(int);
+int             shmctl(int, int);
+
+// slab.c
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            kmemdump(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -141,6 +185,31 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// textcache.c
+void            textinit(void);
+void*           textget(uint, uint, uint, uint, int);
+int             textput(uint, uint, uint, uint, int, void*);
+void            textwrite(uint, uint, uint, char*, uint);
+void            textinval(uint, uint, int);
+void            textzero(uint, uint);
+void            textdump(void);
+
+// swap.c
+void            swapinit(void);
+void            swapreclaim(void);
+int             swapin(pagetable_t, uint64, pte_t*);
+void            swapdup(uint);
+void            swapfree(uint);
+void            swapdump(void);
+
+// zram.c
+void            zraminit(void);
+int             zstore(void*);
+void            zload(int, void*);
+void            zdup(int);
+void            zfree(int);
+void            zramdump(void);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
@@ -158,21 +227,47 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            asidinit(void);
+uint64          asidswitch(struct proc*);
+void            tlbflush(pagetable_t, uint64);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmsplit(pagetable_t, uint64);
+int             vmfault(pagetable_t, uint64, int);
+int             uvmprotect(pagetable_t, uint64, uint64, int, int);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+void            uwinset(pagetable_t);
+void            uwinclear(pagetable_t);
+
+// usercopy.S
+int             copy_user(void*, void*, uint64);
+int             copyinstr_user(char*, char*, uint64);
+
+// vma.c
+struct vma*     vmafind(struct proc*, uint64, uint64);
+int             vmafill(pagetable_t, struct vma*, uint64);
+void            vmaprefault(uint64, uint64, int);
+int             vmacopy(struct proc*, struct proc*);
+void            vmafree(pagetable_t, struct vma*, int);
+uint64          mmap(uint64, uint64, int, int, struct file*, uint);
+int             msync(uint64, uint64);
+int             munmap(uint64, uint64);
+int             mprotect(uint64, uint64, int);
+uint64          shmat(int, uint64, int);
+int             shmdt(uint64);
 
 // plic.c
 void            plicinit(void);
@@ -184,6 +279,9 @@ void            plic_complete(int);
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
 void            virtio_disk_intr(void);
+uint64          virtio_swap_init(void);
+void            virtio_swap_rw(uint64, void *, int);
+void            virtio_swap_intr(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -130,7 +130,7 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
+//   is idle if ip->ref is zero. Otherwise ip->ref tracks
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
@@ -160,33 +160,40 @@ bfree(int dev, uint b)
 // pathname lookup. iget() increments ip->ref so that the inode
 // stays in the table and pointers to it remain valid.
 //
+// In-memory inodes come from a slab cache, so the table
+// grows with the number in use. Up to NINODE inodes that
+// no one refers to any more are kept, valid, in case they
+// are used again soon; beyond that, iput() frees them.
+//
 // Many internal file system functions expect the caller to
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// entries and the hash chains. Since ip->ref indicates whether
+// an entry is in use, and ip->dev and ip->inum indicate which
+// i-node an entry holds, one must hold itable.lock while using
+// any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NINODEHASH 31
+#define INODEHASH(dev, inum) (((dev) * 31 + (inum)) % NINODEHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NINODEHASH];
+  int nidle;          // entries with ref == 0
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,31 +253,30 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[INODEHASH(dev, inum)]; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        itable.nidle--;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  if((ip = kmem_cache_alloc(itable.cache)) == 0)
+    panic("iget: out of memory");
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->nshared = 0;
   ip->valid = 0;
+  ip->next = itable.hash[INODEHASH(dev, inum)];
+  itable.hash[INODEHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -327,8 +333,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// kept idle or freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -357,7 +363,17 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid && itable.nidle < NINODE){
+      itable.nidle++;
+    } else {
+      struct inode **pp;
+      for(pp = &itable.hash[INODEHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->next)
+        ;
+      *pp = ip->next;
+      kmem_cache_free(itable.cache, ip);
+    }
+  }
   release(&itable.lock);
 }
 
@@ -450,6 +466,8 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  textinval(ip->dev, ip->inum, 0);
+  textzero(ip->dev, ip->inum);
 }
 
 // Copy stat information from inode.
@@ -523,6 +541,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    textwrite(ip->dev, ip->inum, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
@@ -535,6 +554,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   // block to ip->addrs[].
   iupdate(ip);
 
+  // running this file as a program must see the new contents.
+  if(tot > 0)
+    textinval(ip->dev, ip->inum, 0);
+
   return tot;
 }
 
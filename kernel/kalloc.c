@@ -1,6 +1,30 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and slabs of small kernel objects (see slab.c).
+//
+// Memory is managed by a binary buddy allocator, which hands
+// out naturally aligned blocks of 2^order pages and merges a
+// freed block with its buddy whenever both halves are free.
+// kalloc_order()/kfree_order() expose it directly for callers
+// that need physically contiguous memory.
+//
+// Single pages, by far the common case, go through kalloc()/
+// kfree() and a per-CPU free list in front of the buddy
+// allocator, so that the common path only touches a lock
+// that no other CPU normally takes. A CPU whose list runs dry
+// refills it with a batch of pages from the buddy allocator;
+// if that is empty too, it steals half of another CPU's list.
+// A CPU whose list grows too long gives a batch back.
+//
+// Most pages are zeroed by whoever allocates them. To take
+// that off the critical path, CPUs with nothing to run
+// zero free pages ahead of time into a small pool (see
+// kzerofill()), from which kalloc_zeroed() allocates.
+//
+// Every physical page also carries a reference count, so
+// that copy-on-write fork can share a page between page
+// tables; kfree() only frees a page when its last
+// reference goes away.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +33,11 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KBATCH   32          // pages moved per refill or drain
+#define KHIWAT   (4*KBATCH)  // drain a CPU's list above this length
+
+#define NPAGES   ((PHYSTOP-KERNBASE)/PGSIZE)
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -16,50 +45,378 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;  // buddy free lists only
 };
 
+// the buddy allocator.
+struct {
+  struct spinlock lock;
+  struct run freelist[MAXORDER+1]; // circular lists of free blocks
+  int nfree[MAXORDER+1];           // length of each list
+
+  // order of the free block starting at each page,
+  // or -1 if no free block starts there.
+  signed char order[NPAGES];
+
+  // statistics, for kallocdump().
+  uint nsplit;
+  uint nmerge;
+} buddy;
+
+// per-CPU free lists of single pages.
 struct {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+
+  // statistics, for kallocdump().
+  uint nfast;     // allocations served from this CPU's list
+  uint nrefill;   // batches taken from the buddy allocator
+  uint nsteal;    // batches stolen from another CPU
+  uint ndrain;    // batches given back to the buddy allocator
+  uint nfail;     // allocations that found no memory at all
+} kcpu[NCPU];
+
+// pre-zeroed pages, for kalloc_zeroed().
+// a page's first word is zeroed again when it is taken.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+
+  // statistics, for kallocdump().
+  uint nhit;      // kalloc_zeroed() calls served from the pool
+  uint nmiss;     // kalloc_zeroed() calls that zeroed a page
+} kzero;
+
+// reference counts, indexed by physical page number.
+// updated with atomic instructions rather than a lock.
+int pageref[NPAGES];
+
+#define PA2PN(pa)  (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define PN2PA(pn)  ((struct run*)(KERNBASE + (uint64)(pn) * PGSIZE))
+#define PA2REF(pa) (&pageref[PA2PN(pa)])
+
+static void buddy_free(struct run *r, int order);
+static void kpush(struct run *head, struct run *tail, int n);
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  initlock(&buddy.lock, "buddy");
+  for(int k = 0; k <= MAXORDER; k++){
+    buddy.freelist[k].next = &buddy.freelist[k];
+    buddy.freelist[k].prev = &buddy.freelist[k];
+  }
+  memset(buddy.order, -1, sizeof(buddy.order));
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcpu[i].lock, "kmem_cpu");
+  initlock(&kzero.lock, "kzero");
   freerange(end, (void*)PHYSTOP);
 }
 
+// Give the pages in [pa_start, pa_end) to the buddy allocator,
+// which merges them into the largest blocks it can.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
+  acquire(&buddy.lock);
   for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+    buddy_free((struct run*)p, 0);
+  release(&buddy.lock);
+}
+
+static void
+buddy_push(struct run *r, int order)
+{
+  struct run *head = &buddy.freelist[order];
+
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+  buddy.order[PA2PN(r)] = order;
+  buddy.nfree[order]++;
+}
+
+static void
+buddy_remove(struct run *r, int order)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  buddy.order[PA2PN(r)] = -1;
+  buddy.nfree[order]--;
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Take a free block of 2^order pages, splitting a larger
+// block if needed. Caller must hold buddy.lock.
+static struct run*
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(buddy.nfree[k] > 0)
+      break;
+  if(k > MAXORDER)
+    return 0;
+
+  r = buddy.freelist[k].next;
+  buddy_remove(r, k);
+
+  // return the upper halves to the free lists.
+  while(k > order){
+    k--;
+    buddy_push(PN2PA(PA2PN(r) + (1L << k)), k);
+    buddy.nsplit++;
+  }
+  return r;
+}
+
+// Return a block of 2^order pages, merging it with its buddy
+// for as long as the buddy is free too.
+// Caller must hold buddy.lock.
+static void
+buddy_free(struct run *r, int order)
+{
+  uint64 pn = PA2PN(r);
+
+  while(order < MAXORDER){
+    uint64 bn = pn ^ (1L << order);
+    if(bn >= NPAGES || buddy.order[bn] != order)
+      break;
+    buddy_remove(PN2PA(bn), order);
+    buddy.nmerge++;
+    pn &= ~(1L << order);
+    order++;
+  }
+  buddy_push(PN2PA(pn), order);
+}
+
+// Find a batch of free pages for CPU id, whose own list
+// is empty: first from the buddy allocator, then by stealing
+// half of some other CPU's list.
+// Must be called with interrupts off and no kmem lock held.
+static struct run*
+refill(int id, int *got, int *stolen)
+{
+  struct run *r, *list;
+  int i;
+
+  *stolen = 0;
+  list = 0;
+  acquire(&buddy.lock);
+  for(i = 0; i < KBATCH; i++){
+    if((r = buddy_alloc(0)) == 0)
+      break;
+    r->next = list;
+    list = r;
+  }
+  release(&buddy.lock);
+  *got = i;
+  if(list)
+    return list;
+
+  for(i = 1; i < NCPU; i++){
+    int victim = (id + i) % NCPU;
+    int n = 0;
+    acquire(&kcpu[victim].lock);
+    list = kcpu[victim].freelist;
+    if(list){
+      struct run *last = list;
+      for(n = 1; n < (kcpu[victim].nfree + 1) / 2 && last->next; n++)
+        last = last->next;
+      kcpu[victim].freelist = last->next;
+      kcpu[victim].nfree -= n;
+      last->next = 0;
+    }
+    release(&kcpu[victim].lock);
+    if(list){
+      *got = n;
+      *stolen = 1;
+      return list;
+    }
+  }
+  return 0;
+}
+
+// Add a reference to the page of physical memory pointed at
+// by pa, which must have been returned by kalloc().
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+  if(__sync_fetch_and_add(PA2REF(pa), 1) < 1)
+    panic("kref: free page");
+}
+
+// Return the number of references to the page at pa.
+int
+krefcount(void *pa)
+{
+  return __atomic_load_n(PA2REF(pa), __ATOMIC_SEQ_CST);
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
+// call to kalloc().
+// The page is freed when no references remain.
 void
 kfree(void *pa)
 {
   struct run *r;
+  int ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  ref = __sync_sub_and_fetch(PA2REF(pa), 1);
+  if(ref < 0)
+    panic("kfree: free page");
+  if(ref > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
+  kpush(r, r, 1);
+}
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+// Drop a reference to each of the n pages in pa[], like
+// kfree(), but put those that become free on this CPU's
+// list all at once, for freeing a whole address space.
+void
+kfreemany(void **pa, int n)
+{
+  struct run *r, *head = 0, *tail = 0;
+  int ref, nfree = 0;
+
+  for(int i = 0; i < n; i++){
+    if(((uint64)pa[i] % PGSIZE) != 0 || (char*)pa[i] < end || (uint64)pa[i] >= PHYSTOP)
+      panic("kfreemany");
+    ref = __sync_sub_and_fetch(PA2REF(pa[i]), 1);
+    if(ref < 0)
+      panic("kfreemany: free page");
+    if(ref > 0)
+      continue;
+    memset(pa[i], 1, PGSIZE);
+    r = (struct run*)pa[i];
+    r->next = head;
+    head = r;
+    if(tail == 0)
+      tail = r;
+    nfree++;
+  }
+  if(head)
+    kpush(head, tail, nfree);
+}
+
+// Put the n free pages on the list from head to tail on
+// this CPU's free list, and give batches back to the buddy
+// allocator while the list is too long.
+static void
+kpush(struct run *head, struct run *tail, int n)
+{
+  struct run *r, *last, *batch = 0;
+  int id;
+
+  push_off();
+  id = cpuid();
+  acquire(&kcpu[id].lock);
+  tail->next = kcpu[id].freelist;
+  kcpu[id].freelist = head;
+  kcpu[id].nfree += n;
+  while(kcpu[id].nfree > KHIWAT){
+    r = kcpu[id].freelist;
+    last = r;
+    for(int i = 1; i < KBATCH; i++)
+      last = last->next;
+    kcpu[id].freelist = last->next;
+    kcpu[id].nfree -= KBATCH;
+    kcpu[id].ndrain++;
+    last->next = batch;
+    batch = r;
+  }
+  release(&kcpu[id].lock);
+
+  if(batch){
+    acquire(&buddy.lock);
+    while(batch){
+      r = batch;
+      batch = r->next;
+      buddy_free(r, 0);
+    }
+    release(&buddy.lock);
+  }
+  pop_off();
+}
+
+// Take a page off this CPU's free list, refilling it if it
+// is empty. Leaves the page's contents and reference count
+// alone. Returns 0 if there is no free page.
+static struct run*
+kalloc_page(void)
+{
+  struct run *r;
+  int id, n, stolen;
+
+  push_off();
+  id = cpuid();
+  acquire(&kcpu[id].lock);
+  r = kcpu[id].freelist;
+  if(r){
+    kcpu[id].freelist = r->next;
+    kcpu[id].nfree--;
+    kcpu[id].nfast++;
+  }
+  release(&kcpu[id].lock);
+
+  if(r == 0){
+    // slow path: keep the first page of a fresh batch
+    // and put the rest on this CPU's list.
+    r = refill(id, &n, &stolen);
+    acquire(&kcpu[id].lock);
+    if(r){
+      struct run *last;
+      for(last = r; last->next; last = last->next)
+        ;
+      last->next = kcpu[id].freelist;
+      kcpu[id].freelist = r->next;
+      kcpu[id].nfree += n - 1;
+      if(stolen)
+        kcpu[id].nsteal++;
+      else
+        kcpu[id].nrefill++;
+    } else {
+      kcpu[id].nfail++;
+    }
+    release(&kcpu[id].lock);
+  }
+  pop_off();
+  return r;
+}
+
+// Take a page from the pre-zeroed pool, or return 0 if
+// the pool is empty.
+static struct run*
+kzero_take(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.nfree--;
+    r->next = 0;
+  }
+  release(&kzero.lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,13 +427,188 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
-
-  if(r)
+  // when memory runs out, the zeroed pool is a last resort.
+  if((r = kalloc_page()) == 0)
+    r = kzero_take();
+  if(r){
+    *PA2REF(r) = 1;
     memset((char*)r, 5, PGSIZE); // fill with junk
+  }
+  return (void*)r;
+}
+
+// Allocate one page of physical memory filled with zeros,
+// from the pre-zeroed pool if it has a page, else by
+// zeroing a page now.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if((r = kzero_take()) != 0){
+    __sync_fetch_and_add(&kzero.nhit, 1);
+    *PA2REF(r) = 1;
+    return (void*)r;
+  }
+  __sync_fetch_and_add(&kzero.nmiss, 1);
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Zero one free page into the pool for kalloc_zeroed(), if
+// the pool is not full. Called by scheduler() when it finds
+// nothing to run, so it does one page at a time, with no
+// lock held while zeroing, to keep that CPU responsive.
+// Returns 1 if it zeroed a page.
+int
+kzerofill(void)
+{
+  struct run *r;
+
+  if(__atomic_load_n(&kzero.nfree, __ATOMIC_RELAXED) >= NZEROPAGE)
+    return 0;
+  if((r = kalloc_page()) == 0)
+    return 0;
+  memset((char*)r, 0, PGSIZE);
+  acquire(&kzero.lock);
+  r->next = kzero.freelist;
+  kzero.freelist = r;
+  kzero.nfree++;
+  release(&kzero.lock);
+  return 1;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Each page starts with one reference.
+// Returns 0 if no large enough block is free.
+void *
+kalloc_order(int order)
+{
+  struct run *r;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    panic("kalloc_order");
+
+  acquire(&buddy.lock);
+  r = buddy_alloc(order);
+  release(&buddy.lock);
+
+  if(r){
+    for(int i = 0; i < (1 << order); i++)
+      pageref[PA2PN(r) + i] = 1;
+    memset((char*)r, 5, PGSIZE << order); // fill with junk
+  }
   return (void*)r;
 }
+
+// Drop a reference to each page of a block returned by
+// kalloc_order(order). If no page of the block is still
+// referenced, the block goes back to the buddy allocator
+// whole; otherwise each unreferenced page is freed alone.
+void
+kfree_order(void *pa, int order)
+{
+  uint64 pn;
+  int nzero;
+  uchar zero[(1 << MAXORDER) / 8];
+
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > MAXORDER ||
+     ((uint64)pa % (PGSIZE << order)) != 0 || (char*)pa < end ||
+     (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+
+  // remember which pages this call freed; another CPU may
+  // drop the last reference to a shared page concurrently.
+  pn = PA2PN(pa);
+  nzero = 0;
+  memset(zero, 0, sizeof(zero));
+  for(int i = 0; i < (1 << order); i++){
+    int ref = __sync_sub_and_fetch(&pageref[pn + i], 1);
+    if(ref < 0)
+      panic("kfree_order: free page");
+    if(ref == 0){
+      zero[i/8] |= 1 << (i%8);
+      nzero++;
+    }
+  }
+  if(nzero == 0)
+    return;
+
+  acquire(&buddy.lock);
+  if(nzero == (1 << order)){
+    memset(pa, 1, PGSIZE << order);
+    buddy_free((struct run*)pa, order);
+  } else {
+    for(int i = 0; i < (1 << order); i++){
+      if(zero[i/8] & (1 << (i%8))){
+        memset(PN2PA(pn + i), 1, PGSIZE);
+        buddy_free(PN2PA(pn + i), 0);
+      }
+    }
+  }
+  release(&buddy.lock);
+}
+
+// Return about how many pages are free, counting the buddy
+// allocator, the per-CPU lists and the pre-zeroed pool.
+// Takes no locks, so the count may be slightly stale.
+int
+kfreecount(void)
+{
+  int n = kzero.nfree;
+
+  for(int k = 0; k <= MAXORDER; k++)
+    n += buddy.nfree[k] << k;
+  for(int i = 0; i < NCPU; i++)
+    n += kcpu[i].nfree;
+  return n;
+}
+
+// Print free-page counts, fast/slow path statistics for each
+// CPU, and how fragmented the buddy allocator's free memory
+// is.  For debugging; runs when user types ^K on console.
+// No lock to avoid wedging a stuck machine further.
+void
+kallocdump(void)
+{
+  int total, big;
+
+  printf("\n");
+  for(int i = 0; i < NCPU; i++){
+    if(kcpu[i].nfast == 0 && kcpu[i].nrefill == 0 && kcpu[i].nfree == 0)
+      continue;
+    printf("cpu %d: free %d fast %u refill %u steal %u drain %u fail %u\n",
+           i, kcpu[i].nfree, kcpu[i].nfast, kcpu[i].nrefill,
+           kcpu[i].nsteal, kcpu[i].ndrain, kcpu[i].nfail);
+  }
+  printf("zeroed: free %d hit %u miss %u\n", kzero.nfree, kzero.nhit, kzero.nmiss);
+
+  total = 0;
+  printf("buddy: free blocks by order:");
+  for(int k = 0; k <= MAXORDER; k++){
+    printf(" %d", buddy.nfree[k]);
+    total += buddy.nfree[k] << k;
+  }
+  printf("\nbuddy: %d free pages, %u splits, %u merges\n",
+         total, buddy.nsplit, buddy.nmerge);
+
+  // the unusable free space index: the share of free memory
+  // that sits in blocks too small for a request of each order.
+  if(total == 0)
+    return;
+  printf("buddy: unusable %% by order:");
+  big = total;
+  for(int k = 0; k <= MAXORDER; k++){
+    printf(" %d", (total - big) * 100 / total);
+    big -= buddy.nfree[k] << k;
+  }
+  printf("\n");
+}
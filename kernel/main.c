@@ -19,6 +19,7 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address space ids
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
@@ -26,9 +27,15 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    textinit();      // executable image cache
+    shminit();       // shared memory segments
     fileinit();      // file table
+    pipeinit();      // pipe buffers
     virtio_disk_init(); // emulated hard disk
+    zraminit();      // compressed swap
+    swapinit();      // swap disk
     userinit();      // first user process
+    reaperinit();    // frees exited processes' memory
     __sync_synchronize();
     started = 1;
   } else {
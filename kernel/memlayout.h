@@ -8,6 +8,7 @@
 // 0C000000 -- PLIC
 // 10000000 -- uart0 
 // 10001000 -- virtio disk 
+// 10002000 -- virtio swap disk
 // 80000000 -- boot ROM jumps here in machine mode
 //             -kernel loads the kernel here
 // unused RAM after 80000000.
@@ -25,6 +26,10 @@
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
 
+// the swap disk, on the next virtio mmio bus.
+#define VIRTIO1 0x10002000
+#define VIRTIO1_IRQ 2
+
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
@@ -55,6 +60,11 @@
 // each surrounded by invalid guard pages.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
+// the current process's user memory, as the kernel sees it
+// through its window (see uwinset()): the upper half of the
+// Sv39 address space, above everything else the kernel maps.
+#define UWIN(va) (0xFFFFFFC000000000L + (uint64)(va))
+
 // User memory layout.
 // Address zero first:
 //   text
@@ -62,6 +72,9 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap()ed regions, placed downward from MMAPTOP
+//   guard page
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define MMAPTOP (TRAPFRAME - PGSIZE)
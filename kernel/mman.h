@@ -0,0 +1,18 @@
+// protections for mmap() and mprotect()
+#define PROT_NONE      0x0
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+#define PROT_EXEC      0x4
+
+// flags for mmap()
+#define MAP_SHARED     0x01
+#define MAP_PRIVATE    0x02
+#define MAP_ANONYMOUS  0x20
+
+#define MAP_FAILED     ((void*)-1)
+
+// System V shared memory; see shm.c
+#define IPC_PRIVATE    0       // key for a new, unnamed segment
+#define IPC_CREAT      0x200   // shmget(): create if it does not exist
+#define IPC_RMID       0       // shmctl(): free once detached everywhere
+#define SHM_RDONLY     0x1000  // shmat(): attach read-only
@@ -1,13 +1,23 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // unused i-nodes kept in memory
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF         (MAXOPBLOCKS*3)  // unused buffers kept in the disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // largest buddy allocation is 2^MAXORDER pages
+#define NZEROPAGE    128   // pre-zeroed pages kept by idle CPUs
+#define NVMA         16    // demand-paged regions per process
+#define FAULTAROUND  8     // pages of a file read in around a page fault
+#define NTEXTPAGE    512   // pages in the executable image cache
+#define NSHM         16    // shared memory segments
+#define NSWAP        4096  // most pages on the swap disk
+#define SWAPLOW      32    // evict pages when fewer than this are free
+#define NZRAM        4096  // most pages of memory for compressed swap
+#define SCHEDLATENCY 2000000  // SCHED_FAIR: timer cycles in which each runnable process runs
+#define SCHEDMINGRAN 1000000  // SCHED_FAIR: shortest slice; one timer interrupt
@@ -59,7 +59,8 @@ printptr(uint64 x)
     consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the console. only understands %d, %x, %p, %s.
+// Print to the console. only understands %d, %u, %x, %p,
+// %s and %%.
 void
 printf(char *fmt, ...)
 {
@@ -87,6 +88,9 @@ printf(char *fmt, ...)
     case 'd':
       printint(va_arg(ap, int), 10, 1);
       break;
+    case 'u':
+      printint(va_arg(ap, int), 10, 0);
+      break;
     case 'x':
       printint(va_arg(ap, int), 16, 1);
       break;
@@ -4,6 +4,8 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "sched.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -17,6 +19,7 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void setrunnable(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,6 +29,60 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// a page table whose processes swap.c has stopped from
+// running while it evicts one of its pages, and the process
+// doing that, which may still run; see procstop().
+struct {
+  pagetable_t pagetable;
+  struct proc *by;
+} stopped;
+
+// the scheduling policy; see scheduler(). the Makefile's
+// SCHED variable picks it.
+#ifndef SCHEDPOLICY
+#define SCHEDPOLICY SCHED_RR
+#endif
+int schedpolicy = SCHEDPOLICY;
+
+// the CPUs that have started scheduling, for setaffinity().
+uint64 cpuonline;
+
+// per-CPU queues of RUNNABLE processes. a process joins the
+// queue of the CPU it last ran on, for the sake of that
+// CPU's caches; a CPU whose queue is empty takes from the
+// longest one. processes with a real-time priority, their
+// own or lent to them (see prioboost()), go ahead of the
+// rest, highest priority first.
+struct runq {
+  struct spinlock lock;
+  struct proc *rt;       // real time, linked through p->rqnext
+  struct proc *head;     // SCHED_RR: FIFO, linked through p->rqnext
+  struct proc *tail;
+  struct proc *root;     // SCHED_FAIR: tree ordered by p->vruntime
+  uint64 weight;         // SCHED_FAIR: of the processes in the tree
+  uint64 minvruntime;    // SCHED_FAIR: least vruntime lately; never decreases
+  int n;                 // processes on the queue, counting rt
+} runq[NCPU];
+
+// processes in sleep(), in a table of queues hashed by the
+// channel they sleep on, so that wakeup() need only look at
+// those that might be sleeping on its channel. each queue
+// is linked through p->sqnext, oldest first.
+#define NSLEEPQ 61
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+// page tables of exited processes, for the reaper to
+// free along with the memory they map; see exit().
+struct {
+  struct spinlock lock;
+  pagetable_t pagetable[NPROC];
+  int n;
+  int busy;     // the reaper is freeing one
+} reap;
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -51,6 +108,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -124,6 +185,16 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid();
+  p->nice = 0;
+  p->vruntime = 0;
+  p->sclass = SCHED_OTHER;
+  p->rtprio = 0;
+  p->prio = 0;
+  p->rqprio = -1;
+  p->affinity = ALLCPUS;
+  p->held = 0;
+  p->waitlock = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -161,6 +232,7 @@ freeproc(struct proc *p)
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->asid = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -168,6 +240,7 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->vforked = 0;
   p->state = UNUSED;
 }
 
@@ -188,7 +261,7 @@ proc_pagetable(struct proc *p)
   // only the supervisor uses it, on the way
   // to/from user space, so not PTE_U.
   if(mappages(pagetable, TRAMPOLINE, PGSIZE,
-              (uint64)trampoline, PTE_R | PTE_X) < 0){
+              (uint64)trampoline, PTE_R | PTE_X | PTE_G) < 0){
     uvmfree(pagetable, 0);
     return 0;
   }
@@ -212,6 +285,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uwinclear(pagetable);
   uvmfree(pagetable, sz);
 }
 
@@ -249,12 +323,14 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only reserves the address range; vmfault()
+// allocates each page when it is first touched.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -264,9 +340,9 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > MMAPTOP || vmafind(p, PGROUNDUP(sz), sz + n) != 0)
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -283,18 +359,25 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  swapreclaim();
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  if(uvmcopy(p->pagetable, np->pagetable, 0, p->sz) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  if(vmacopy(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -309,6 +392,12 @@ fork(void)
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+  np->sclass = p->sclass;
+  np->rtprio = p->rtprio;
+  np->prio = p->rtprio;
+  np->affinity = p->affinity;
 
   pid = np->pid;
 
@@ -319,12 +408,153 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Create a new process running the program in path, with
+// ofile[] as its open files, without copying the parent's
+// memory as fork() and exec() would. ofile[] has NOFILE
+// entries, some of which may be 0.
+// Returns the child's pid, or -1 on failure.
+int
+spawn(char *path, char **argv, struct file **ofile)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  pid = np->pid;
+  // exec() may sleep; np is not RUNNABLE, so no one else
+  // will touch it meanwhile.
+  release(&np->lock);
+
+  if((argc = exec(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  for(i = 0; i < NOFILE; i++)
+    if(ofile[i])
+      np->ofile[i] = filedup(ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+  np->sclass = p->sclass;
+  np->rtprio = p->rtprio;
+  np->prio = p->rtprio;
+  np->affinity = p->affinity;
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Point pagetable's TRAPFRAME page at tf.
+static void
+maptrapframe(pagetable_t pagetable, struct trapframe *tf)
+{
+  pte_t *pte;
+
+  if((pte = walk(pagetable, TRAPFRAME, 0)) == 0 || (*pte & PTE_V) == 0)
+    panic("maptrapframe");
+  *pte = PA2PTE(tf) | PTE_R | PTE_W | PTE_V;
+}
+
+// Create a new process that runs in the parent's address
+// space, rather than a copy of it, until it calls exec()
+// or exit(); the parent waits until then. The child must
+// not return from the function that called vfork(), since
+// it shares the parent's stack.
+int
+vfork(void)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  // lend the child p's address space. while p waits,
+  // the page table's trapframe page is the child's.
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = p->pagetable;
+  np->sz = p->sz;
+  memmove(np->vma, p->vma, sizeof(p->vma));
+  np->vforked = 1;
+  maptrapframe(np->pagetable, np->trapframe);
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->a0 = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+  np->sclass = p->sclass;
+  np->rtprio = p->rtprio;
+  np->prio = p->rtprio;
+  np->affinity = p->affinity;
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  while(np->vforked)
+    sleep(p, &wait_lock);
+  release(&wait_lock);
+
+  return pid;
+}
+
+// Give the address space that vfork() lent p back to p's
+// parent, with size sz and the regions in vma[], which may
+// have changed while p had it. Called when p execs or
+// exits.
+void
+vforkreturn(struct proc *p, uint64 sz, struct vma *vma)
+{
+  struct proc *pp;
+
+  acquire(&wait_lock);
+  pp = p->parent;
+  pp->sz = sz;
+  memmove(pp->vma, vma, sizeof(pp->vma));
+  maptrapframe(pp->pagetable, pp->trapframe);
+  pp->asid = 0;   // its TLB entries may be stale
+  p->vforked = 0;
+  wakeup(pp);
+  release(&wait_lock);
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -347,6 +577,7 @@ void
 exit(int status)
 {
   struct proc *p = myproc();
+  pagetable_t pagetable;
 
   if(p == initproc)
     panic("init exiting");
@@ -365,6 +596,33 @@ exit(int status)
   end_op();
   p->cwd = 0;
 
+  if(p->vforked){
+    vforkreturn(p, p->sz, p->vma);
+    memset(p->vma, 0, sizeof(p->vma));
+    p->pagetable = 0;
+    p->sz = 0;
+  } else {
+    // leave freeing the address space to the reaper, so
+    // that neither this process nor its parent's wait()
+    // waits for it.
+    vmafree(p->pagetable, p->vma, 0);
+    uwinclear(p->pagetable);
+    acquire(&p->lock);
+    pagetable = p->pagetable;
+    p->pagetable = 0;
+    p->sz = 0;
+    release(&p->lock);
+    acquire(&reap.lock);
+    if(reap.n < NPROC){
+      reap.pagetable[reap.n++] = pagetable;
+      wakeup(&reap);
+      pagetable = 0;
+    }
+    release(&reap.lock);
+    if(pagetable)
+      proc_freepagetable(pagetable, MMAPTOP);
+  }
+
   acquire(&wait_lock);
 
   // Give any children to init.
@@ -385,13 +643,74 @@ exit(int status)
   panic("zombie exit");
 }
 
+// The reaper, a kernel thread: frees the address spaces
+// that exit() leaves it, with all the pages and page-table
+// pages in them. The pages go back on the reaper's CPU's
+// free list in batches; see uvmunmap().
+static void
+reaper(void)
+{
+  pagetable_t pagetable;
+
+  // still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  acquire(&reap.lock);
+  for(;;){
+    while(reap.n == 0)
+      sleep(&reap, &reap.lock);
+    pagetable = reap.pagetable[--reap.n];
+    reap.busy = 1;
+    release(&reap.lock);
+    // the trapframe page stays with the proc until wait().
+    proc_freepagetable(pagetable, MMAPTOP);
+    acquire(&reap.lock);
+    reap.busy = 0;
+    if(reap.n == 0)
+      wakeup(&reap.busy);
+  }
+}
+
+// Wait until the reaper has freed every address space it
+// has been given, for swapreclaim(): memory that no one
+// uses any more is better to have back than memory a
+// process would have to read back in.
+void
+reapwait(void)
+{
+  acquire(&reap.lock);
+  while(reap.n > 0 || reap.busy)
+    sleep(&reap.busy, &reap.lock);
+  release(&reap.lock);
+}
+
+// Start the reaper: a process with no user memory, which
+// runs reaper() in the kernel and never exits.
+void
+reaperinit(void)
+{
+  struct proc *p;
+
+  initlock(&reap.lock, "reap");
+  if((p = allocproc()) == 0)
+    panic("reaperinit");
+  proc_freepagetable(p->pagetable, 0);
+  p->pagetable = 0;
+  kfree((void*)p->trapframe);
+  p->trapframe = 0;
+  p->context.ra = (uint64)reaper;
+  safestrcpy(p->name, "reaper", sizeof(p->name));
+  setrunnable(p);
+  release(&p->lock);
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int
 wait(uint64 addr)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
@@ -407,13 +726,20 @@ wait(uint64 addr)
         havekids = 1;
         if(pp->state == ZOMBIE){
           // Found one.
+          // copy the status out before freeing the child,
+          // so that neither is lost if copyout() fails, but
+          // after letting go of the locks, since copyout()
+          // may have to read the page in from a file. only
+          // p reaps its children, so pp stays a zombie.
           pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
+          xstate = pp->xstate;
+          release(&pp->lock);
+          release(&wait_lock);
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                  sizeof(xstate)) < 0)
             return -1;
-          }
+          acquire(&wait_lock);
+          acquire(&pp->lock);
           freeproc(pp);
           release(&pp->lock);
           release(&wait_lock);
@@ -434,10 +760,440 @@ wait(uint64 addr)
   }
 }
 
+// Can scheduler() on CPU id start p? Not if its affinity
+// mask leaves out that CPU, or if swap.c has stopped its
+// page table. scheduler() checks again holding p->lock.
+static int
+startable(struct proc *p, int id)
+{
+  if((p->affinity & (1L << id)) == 0)
+    return 0;
+  return p->pagetable == 0 || p->pagetable != stopped.pagetable ||
+         p == stopped.by;
+}
+
+// SCHED_FAIR's weight for each nice value, from -20 to 19:
+// each step is a CPU share about 1.25 times the next's.
+static const uint niceweight[40] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+   9548,  7620,  6100,  4904,  3906,
+   3121,  2501,  1991,  1586,  1277,
+   1024,   820,   655,   526,   423,
+    335,   272,   215,   172,   137,
+    110,    87,    70,    56,    45,
+     36,    29,    23,    18,    15,
+};
+#define NICE0WEIGHT 1024
+#define WEIGHT(p) (niceweight[(p)->nice + 20])
+
+// A fair run queue keeps its processes in an AVL tree
+// ordered by vruntime, so that the process that has had
+// the least weighted CPU time is the leftmost.
+
+// Does p go before q in the tree?
+static int
+vrbefore(struct proc *p, struct proc *q)
+{
+  if(p->vruntime != q->vruntime)
+    return p->vruntime < q->vruntime;
+  return p < q;
+}
+
+static int
+height(struct proc *t)
+{
+  return t ? t->rqheight : 0;
+}
+
+// Recompute t's height from its children's.
+static struct proc*
+fixheight(struct proc *t)
+{
+  int l = height(t->rqleft), r = height(t->rqright);
+
+  t->rqheight = (l > r ? l : r) + 1;
+  return t;
+}
+
+static struct proc*
+rotright(struct proc *t)
+{
+  struct proc *l = t->rqleft;
+
+  t->rqleft = l->rqright;
+  l->rqright = fixheight(t);
+  return fixheight(l);
+}
+
+static struct proc*
+rotleft(struct proc *t)
+{
+  struct proc *r = t->rqright;
+
+  t->rqright = r->rqleft;
+  r->rqleft = fixheight(t);
+  return fixheight(r);
+}
+
+// Restore the balance of t, whose subtrees are balanced
+// and differ in height by at most two. Returns the new root.
+static struct proc*
+rebalance(struct proc *t)
+{
+  int b = height(t->rqleft) - height(t->rqright);
+
+  if(b > 1){
+    if(height(t->rqleft->rqleft) < height(t->rqleft->rqright))
+      t->rqleft = rotleft(t->rqleft);
+    return rotright(t);
+  }
+  if(b < -1){
+    if(height(t->rqright->rqright) < height(t->rqright->rqleft))
+      t->rqright = rotright(t->rqright);
+    return rotleft(t);
+  }
+  return fixheight(t);
+}
+
+// Insert p into tree t. Returns the new root.
+static struct proc*
+treeinsert(struct proc *t, struct proc *p)
+{
+  if(t == 0){
+    p->rqleft = p->rqright = 0;
+    p->rqheight = 1;
+    return p;
+  }
+  if(vrbefore(p, t))
+    t->rqleft = treeinsert(t->rqleft, p);
+  else
+    t->rqright = treeinsert(t->rqright, p);
+  return rebalance(t);
+}
+
+// Take the leftmost process out of tree t, and set *min to
+// it. Returns the new root.
+static struct proc*
+treedelmin(struct proc *t, struct proc **min)
+{
+  if(t->rqleft == 0){
+    *min = t;
+    return t->rqright;
+  }
+  t->rqleft = treedelmin(t->rqleft, min);
+  return rebalance(t);
+}
+
+// Take p out of tree t. Returns the new root.
+static struct proc*
+treedelete(struct proc *t, struct proc *p)
+{
+  struct proc *m;
+
+  if(t == 0)
+    panic("treedelete");
+  if(t == p){
+    if(t->rqleft == 0)
+      return t->rqright;
+    if(t->rqright == 0)
+      return t->rqleft;
+    t->rqright = treedelmin(t->rqright, &m);
+    m->rqleft = t->rqleft;
+    m->rqright = t->rqright;
+    return rebalance(m);
+  }
+  if(vrbefore(p, t))
+    t->rqleft = treedelete(t->rqleft, p);
+  else
+    t->rqright = treedelete(t->rqright, p);
+  return rebalance(t);
+}
+
+// The leftmost process in tree t that scheduler() on CPU
+// id can start.
+static struct proc*
+treefirst(struct proc *t, int id)
+{
+  struct proc *p;
+
+  if(t == 0)
+    return 0;
+  if((p = treefirst(t->rqleft, id)) != 0)
+    return p;
+  if(startable(t, id))
+    return t;
+  return treefirst(t->rqright, id);
+}
+
+// Add p to run queue rq: if it has a real-time priority,
+// after the others of its priority and ahead of those
+// with less. If p is waking up, rather than giving up the
+// CPU, a fair queue places it no more than half of
+// SCHEDLATENCY behind the queue's least vruntime: a
+// process does not bank the CPU time it did not use while
+// it slept. Caller must hold p->lock.
+static void
+runqput(struct runq *rq, struct proc *p, int waking)
+{
+  struct proc **pp;
+
+  acquire(&rq->lock);
+  p->rqprio = p->prio;
+  if(p->prio > 0){
+    for(pp = &rq->rt; *pp && (*pp)->rqprio >= p->prio; pp = &(*pp)->rqnext)
+      ;
+    p->rqnext = *pp;
+    *pp = p;
+  } else if(schedpolicy == SCHED_FAIR){
+    if(waking && p->vruntime + SCHEDLATENCY/2 < rq->minvruntime)
+      p->vruntime = rq->minvruntime - SCHEDLATENCY/2;
+    p->rqweight = WEIGHT(p);
+    rq->weight += p->rqweight;
+    rq->root = treeinsert(rq->root, p);
+  } else {
+    p->rqnext = 0;
+    if(rq->tail)
+      rq->tail->rqnext = p;
+    else
+      rq->head = p;
+    rq->tail = p;
+  }
+  rq->n++;
+  release(&rq->lock);
+}
+
+// Take the next process to run from run queue rq: the
+// first real-time one, else the one with the least
+// vruntime, or the one at the head, that scheduler() on
+// CPU id can start. Returns 0 if there is none.
+static struct proc*
+runqget(struct runq *rq, int id)
+{
+  struct proc *p, **pp, *prev;
+
+  acquire(&rq->lock);
+  for(pp = &rq->rt; (p = *pp) != 0 && !startable(p, id); pp = &p->rqnext)
+    ;
+  if(p){
+    *pp = p->rqnext;
+  } else if(schedpolicy == SCHED_FAIR){
+    if((p = treefirst(rq->root, id)) != 0){
+      rq->root = treedelete(rq->root, p);
+      rq->weight -= p->rqweight;
+      if(p->vruntime > rq->minvruntime)
+        rq->minvruntime = p->vruntime;
+    }
+  } else {
+    for(prev = 0, p = rq->head; p && !startable(p, id); prev = p, p = p->rqnext)
+      ;
+    if(p){
+      if(prev)
+        prev->rqnext = p->rqnext;
+      else
+        rq->head = p->rqnext;
+      if(rq->tail == p)
+        rq->tail = prev;
+    }
+  }
+  if(p){
+    p->rqprio = -1;
+    rq->n--;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Take p off run queue rq, for a change of its priority.
+// Returns 0 if it is not on it: scheduler() has just taken
+// it. Caller must hold p->lock.
+static int
+runqremove(struct runq *rq, struct proc *p)
+{
+  struct proc **pp, *prev;
+
+  acquire(&rq->lock);
+  if(p->rqprio < 0){
+    release(&rq->lock);
+    return 0;
+  }
+  if(p->rqprio > 0){
+    for(pp = &rq->rt; *pp != p; pp = &(*pp)->rqnext)
+      ;
+    *pp = p->rqnext;
+  } else if(schedpolicy == SCHED_FAIR){
+    rq->root = treedelete(rq->root, p);
+    rq->weight -= p->rqweight;
+  } else {
+    for(prev = 0, pp = &rq->head; *pp != p; prev = *pp, pp = &(*pp)->rqnext)
+      ;
+    *pp = p->rqnext;
+    if(rq->tail == p)
+      rq->tail = prev;
+  }
+  p->rqprio = -1;
+  rq->n--;
+  release(&rq->lock);
+  return 1;
+}
+
+// Change p's priority to prio, moving it to its place on
+// its run queue if it is RUNNABLE. Caller must hold p->lock.
+static void
+reprio(struct proc *p, int prio)
+{
+  int queued = 0;
+
+  if(p->state == RUNNABLE)
+    queued = runqremove(&runq[p->cpu], p);
+  p->prio = prio;
+  if(queued)
+    runqput(&runq[p->cpu], p, 0);
+}
+
+// Take a process from the longest of the other CPUs' run
+// queues, for CPU id, whose own queue is empty; or, if
+// all of that one's processes are pinned elsewhere, from
+// any other. Returns 0 if there is nothing to take.
+static struct proc*
+runqsteal(int id)
+{
+  struct runq *rq, *busiest = 0;
+  struct proc *p = 0;
+
+  for(rq = runq; rq < &runq[NCPU]; rq++){
+    if(rq == &runq[id])
+      continue;
+    if(busiest == 0 || rq->n > busiest->n)
+      busiest = rq;
+  }
+  if(busiest == 0 || busiest->n == 0)
+    return 0;
+  if((p = runqget(busiest, id)) == 0){
+    for(rq = runq; rq < &runq[NCPU]; rq++){
+      if(rq == &runq[id] || rq == busiest || rq->n == 0)
+        continue;
+      if((p = runqget(rq, id)) != 0){
+        busiest = rq;
+        break;
+      }
+    }
+    if(p == 0)
+      return 0;
+  }
+  if(schedpolicy == SCHED_FAIR){
+    // keep its place relative to the others, in vruntime
+    // terms, on its new CPU.
+    if(p->vruntime > busiest->minvruntime)
+      p->vruntime = p->vruntime - busiest->minvruntime + runq[id].minvruntime;
+    else
+      p->vruntime = runq[id].minvruntime;
+  }
+  return p;
+}
+
+// The run queue on which p belongs: that of the CPU it
+// last ran on, unless its affinity mask now leaves that
+// CPU out. Caller must hold p->lock.
+static struct runq*
+homeq(struct proc *p)
+{
+  uint64 mask;
+  int i;
+
+  if((p->affinity & (1L << p->cpu)) == 0){
+    if((mask = p->affinity & cpuonline) == 0)
+      mask = p->affinity;
+    for(i = 0; (mask & (1L << i)) == 0; i++)
+      ;
+    p->cpu = i;
+  }
+  return &runq[p->cpu];
+}
+
+// Make p RUNNABLE, on the run queue of the CPU it last ran
+// on, or of one its affinity mask allows.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  int waking = p->state != RUNNING;
+
+  p->state = RUNNABLE;
+  runqput(homeq(p), p, waking);
+}
+
+// Charge p, which is running on this CPU, for the CPU time
+// it has used since it was last charged. Only the fair
+// policy keeps count.
+// Caller must hold p->lock.
+static void
+charge(struct proc *p)
+{
+  uint64 now, d;
+
+  if(schedpolicy != SCHED_FAIR)
+    return;
+  now = r_time();
+  d = now - p->execstart;
+  p->execstart = now;
+  p->slice += d;
+  p->vruntime += d * NICE0WEIGHT / WEIGHT(p);
+}
+
+// Called on each timer interrupt while a process is
+// running: returns whether it should give up the CPU.
+// Always if its affinity mask no longer allows this CPU,
+// or if a process of higher real-time priority is
+// waiting. Otherwise, a real-time process keeps the CPU,
+// but an SCHED_RTRR one gives way after a tick to one of
+// its own priority. Other processes give way under
+// SCHED_RR always; under SCHED_FAIR, once they have run
+// for their share of SCHEDLATENCY, in proportion to their
+// weight, but for at least SCHEDMINGRAN, and if another
+// process is waiting.
+int
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct runq *rq;
+  uint64 w, slice;
+  int preempt = 0;
+
+  acquire(&p->lock);
+  charge(p);
+  rq = &runq[p->cpu];
+  acquire(&rq->lock);
+  if((p->affinity & (1L << p->cpu)) == 0){
+    // setaffinity() has moved it off this CPU.
+    preempt = 1;
+  } else if(rq->rt && rq->rt->rqprio > p->prio){
+    preempt = 1;
+  } else if(p->prio > 0){
+    preempt = rq->rt && p->sclass == SCHED_RTRR && p->prio == p->rtprio;
+  } else if(schedpolicy != SCHED_FAIR){
+    preempt = 1;
+  } else if(rq->n > 0){
+    w = WEIGHT(p);
+    slice = SCHEDLATENCY * w / (rq->weight + w);
+    if(slice < SCHEDMINGRAN)
+      slice = SCHEDMINGRAN;
+    preempt = p->slice >= slice;
+  }
+  release(&rq->lock);
+  release(&p->lock);
+  return preempt;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from this CPU's run queue
+//    or, if that is empty, another CPU's: the one with the
+//    highest real-time priority (see setscheduler()), if
+//    any; else, under SCHED_RR, the one that has waited
+//    longest; under SCHED_FAIR, the one that has had the
+//    least CPU time for its weight (see setpriority()).
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,28 +1202,48 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
   c->proc = 0;
+  __sync_fetch_and_or(&cpuonline, 1L << id);
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
+    if((p = runqget(&runq[id], id)) == 0 && (p = runqsteal(id)) == 0){
+      // nothing to run: zero a page for kalloc_zeroed()
+      // rather than spin.
+      kzerofill();
+      continue;
+    }
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    if(!startable(p, id)){
+      // swap.c has just started changing its memory, or
+      // setaffinity() has just moved it; later.
+      p->cpu = id;
+      runqput(homeq(p), p, 0);
       release(&p->lock);
+      continue;
     }
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    if(schedpolicy == SCHED_FAIR)
+      p->execstart = r_time();
+    p->slice = 0;
+    c->proc = p;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -504,7 +1280,8 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  charge(p);
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -530,53 +1307,148 @@ forkret(void)
   usertrapret();
 }
 
+// The sleep queue for chan.
+static struct sleepq*
+chanq(void *chan)
+{
+  return &sleepq[((uint64)chan / sizeof(uint64)) % NSLEEPQ];
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q = chanq(chan);
+  struct proc **pp;
+  int queued;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's queue's lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks it),
   // so it's okay to release lk.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
+  charge(p);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sqnext = 0;
+  for(pp = &q->head; *pp; pp = &(*pp)->sqnext)
+    ;
+  *pp = p;
+  p->onsleepq = 1;
+  release(&q->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  queued = p->onsleepq;
+  release(&p->lock);
+
+  // kill() wakes a process without taking it off its queue.
+  if(queued){
+    acquire(&q->lock);
+    for(pp = &q->head; *pp; pp = &(*pp)->sqnext){
+      if(*pp == p){
+        *pp = p->sqnext;
+        break;
+      }
+    }
+    p->onsleepq = 0;
+    release(&q->lock);
+  }
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
-// Wake up all processes sleeping on chan.
-// Must be called without any p->lock.
-void
-wakeup(void *chan)
+// Wake up the processes sleeping on chan, or if all is 0
+// just one: the one of highest priority that has slept
+// longest.
+static void
+wake(void *chan, int all)
 {
-  struct proc *p;
+  struct sleepq *q = chanq(chan);
+  struct proc *p, **pp, **best;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&q->lock);
+again:
+  best = 0;
+  for(pp = &q->head; (p = *pp) != 0; ){
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        if(all){
+          *pp = p->sqnext;
+          p->onsleepq = 0;
+          setrunnable(p);
+          release(&p->lock);
+          continue;
+        }
+        if(best == 0 || p->prio > (*best)->prio)
+          best = pp;
       }
       release(&p->lock);
     }
+    pp = &p->sqnext;
+  }
+  if(best){
+    p = *best;
+    acquire(&p->lock);
+    if(p->state != SLEEPING){
+      // kill() woke it meanwhile.
+      release(&p->lock);
+      goto again;
+    }
+    *best = p->sqnext;
+    p->onsleepq = 0;
+    setrunnable(p);
+    release(&p->lock);
   }
+  release(&q->lock);
+}
+
+// The highest priority of the processes sleeping on chan,
+// or 0 if there are none.
+int
+sleepprio(void *chan)
+{
+  struct sleepq *q = chanq(chan);
+  struct proc *p;
+  int prio = 0;
+
+  acquire(&q->lock);
+  for(p = q->head; p; p = p->sqnext)
+    if(p->chan == chan && p->prio > prio)
+      prio = p->prio;
+  release(&q->lock);
+  return prio;
+}
+
+// Wake up all processes sleeping on chan.
+// Must be called without any p->lock.
+void
+wakeup(void *chan)
+{
+  wake(chan, 1);
+}
+
+// Wake up one process sleeping on chan, the one of highest
+// priority, for waiters of which only one can go ahead,
+// such as for a sleep-lock.
+// Must be called without any p->lock.
+void
+wakeupone(void *chan)
+{
+  wake(chan, 0);
 }
 
 // Kill the process with the given pid.
@@ -593,7 +1465,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        setrunnable(p);
       }
       release(&p->lock);
       return 0;
@@ -603,6 +1475,222 @@ kill(int pid)
   return -1;
 }
 
+// Set the nice value of process pid, or of the caller if
+// pid is 0, to nice, from -20 (most CPU) to 19 (least).
+// Under SCHED_FAIR, a process's share of the CPU is in
+// proportion to its weight, niceweight[nice+20]; the new
+// weight applies from its next turn on a run queue.
+// Returns 0, or -1 if there is no such process.
+int
+setpriority(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < -20 || nice > 19)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->nice = nice;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// p's priority: its real-time priority, or more if it
+// holds a sleep-lock for which a process of higher priority
+// waits. Caller must hold p->lock.
+static int
+heldprio(struct proc *p)
+{
+  struct sleeplock *lk;
+  int prio = p->rtprio;
+
+  for(lk = p->held; lk; lk = lk->nextheld)
+    if(lk->waitprio > prio)
+      prio = lk->waitprio;
+  return prio;
+}
+
+// Make process pid, or the caller if pid is 0, use
+// scheduling class sclass: SCHED_OTHER, with prio 0, or a
+// real-time class, SCHED_RTFIFO or SCHED_RTRR, with prio
+// from 1 to RTPRIOMAX. A real-time process runs ahead of
+// any process of lower priority (see scheduler()).
+// Returns 0, or -1 if the arguments are bad or there is no
+// such process.
+int
+setscheduler(int pid, int sclass, int prio)
+{
+  struct proc *p;
+
+  if(sclass == SCHED_OTHER){
+    if(prio != 0)
+      return -1;
+  } else if(sclass == SCHED_RTFIFO || sclass == SCHED_RTRR){
+    if(prio < 1 || prio > RTPRIOMAX)
+      return -1;
+  } else {
+    return -1;
+  }
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->sclass = sclass;
+      p->rtprio = prio;
+      reprio(p, heldprio(p));
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Priority inheritance for sleep-locks: a process of
+// priority prio waits for a sleep-lock that p holds. Lend
+// p that priority until it releases the lock (see
+// priorelease()), and so on along the chain of sleep-locks
+// for which p waits in turn, so that no process of lesser
+// priority can hold the waiter up for long.
+static void
+prioboost(struct proc *p, int prio)
+{
+  struct sleeplock *lk;
+  int old;
+
+  for(int i = 0; p && i < NPROC; i++){
+    acquire(&p->lock);
+    if(p->prio >= prio || p->held == 0){
+      release(&p->lock);
+      break;
+    }
+    reprio(p, prio);
+    lk = p->waitlock;
+    release(&p->lock);
+    if(lk == 0)
+      break;
+    // p waits for lk, so its holder must release it before
+    // p can release the lock it holds. lk->lk is not held:
+    // its holder may change meanwhile, costing no more than
+    // a needless loan until that process next releases a
+    // sleep-lock.
+    while((old = lk->waitprio) < prio)
+      if(__sync_bool_compare_and_swap(&lk->waitprio, old, prio))
+        break;
+    p = lk->holder;
+  }
+}
+
+// The caller is about to sleep waiting for sleep-lock lk,
+// and holds lk->lk.
+void
+priowait(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  p->waitlock = lk;
+  release(&p->lock);
+  if(lk->waitprio < p->prio)
+    lk->waitprio = p->prio;
+  prioboost(lk->holder, p->prio);
+}
+
+// The caller has acquired sleep-lock lk, and holds lk->lk.
+// Any processes still waiting lend it their priority.
+void
+priohold(struct sleeplock *lk)
+{
+  struct proc *p = myproc();
+
+  lk->waitprio = sleepprio(lk);
+  acquire(&p->lock);
+  p->waitlock = 0;
+  lk->nextheld = p->held;
+  p->held = lk;
+  release(&p->lock);
+  prioboost(p, lk->waitprio);
+}
+
+// lk's holder is about to release it, and holds lk->lk:
+// take back the priority lent to it for lk's sake.
+void
+priorelease(struct sleeplock *lk)
+{
+  struct proc *p = lk->holder;
+  struct sleeplock **lp;
+
+  acquire(&p->lock);
+  for(lp = &p->held; *lp != lk; lp = &(*lp)->nextheld)
+    ;
+  *lp = lk->nextheld;
+  reprio(p, heldprio(p));
+  release(&p->lock);
+}
+
+// Let process pid, or the caller if pid is 0, run only on
+// the CPUs whose bits are set in mask. It moves off a CPU
+// the mask leaves out the next time it gives up that CPU,
+// at once if it is the caller. Returns 0, or -1 if mask
+// includes no running CPU or there is no such process.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  int move;
+
+  mask &= ALLCPUS;
+  if((mask & cpuonline) == 0)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->affinity = mask;
+      move = (mask & (1L << p->cpu)) == 0;
+      if(move && p->state == RUNNABLE && runqremove(&runq[p->cpu], p))
+        runqput(homeq(p), p, 0);
+      release(&p->lock);
+      if(move && p == myproc())
+        yield();
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Set *mask to the affinity mask of process pid, or of the
+// caller if pid is 0, less CPUs that are not running.
+// Returns 0, or -1 if there is no such process.
+int
+getaffinity(int pid, uint64 *mask)
+{
+  struct proc *p;
+
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      *mask = p->affinity & cpuonline;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 void
 setkilled(struct proc *p)
 {
@@ -652,6 +1740,70 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
   }
 }
 
+// For swap.c: keep proc[i], and any other process that
+// shares its page table, from running, so that the pages
+// the page table maps can be changed under them; the
+// caller may sleep meanwhile. Only one page table can be
+// stopped at a time.
+// Returns the page table, or 0 if proc[i] has no user
+// memory or a process that uses it is running elsewhere,
+// or was preempted in the kernel and so may be in the
+// middle of using a page. A process that sleeps holds on
+// to no user page meanwhile.
+pagetable_t
+procstop(int i)
+{
+  struct proc *q = &proc[i], *pp;
+  pagetable_t pagetable;
+
+  acquire(&q->lock);
+  pagetable = q->pagetable;
+  if(pagetable == 0 || (q != myproc() &&
+     ((q->state != SLEEPING && q->state != RUNNABLE) || q->kpreempted))){
+    release(&q->lock);
+    return 0;
+  }
+  // from now on scheduler() will not start q.
+  stopped.by = myproc();
+  stopped.pagetable = pagetable;
+  release(&q->lock);
+
+  for(pp = proc; pp < &proc[NPROC]; pp++){
+    if(pp == q || pp == myproc())
+      continue;
+    acquire(&pp->lock);
+    if(pp->pagetable == pagetable && (pp->state == RUNNING || pp->kpreempted)){
+      release(&pp->lock);
+      stopped.pagetable = 0;
+      return 0;
+    }
+    release(&pp->lock);
+  }
+  return pagetable;
+}
+
+// Let the processes that procstop() stopped run again. If
+// changed is set, their page table's mappings have changed,
+// and they may have stale TLB entries on any CPU, so they
+// get new address space ids.
+void
+procresume(pagetable_t pagetable, int changed)
+{
+  struct proc *pp;
+
+  if(changed){
+    // the evictor may have changed its own page table.
+    uwinclear(pagetable);
+    for(pp = proc; pp < &proc[NPROC]; pp++){
+      acquire(&pp->lock);
+      if(pp->pagetable == pagetable)
+        pp->asid = 0;
+      release(&pp->lock);
+    }
+  }
+  __atomic_store_n(&stopped.pagetable, 0, __ATOMIC_RELEASE);
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -24,6 +24,10 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation the TLB has been flushed for
+  pagetable_t kpagetable;     // This CPU's kernel page table; see uwinset()
+  pagetable_t uwin;           // User page table its window shows, or 0
+  uint64 uwinasid;            // ASID of the process it was shown for
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,6 +85,25 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// an affinity mask that allows every CPU.
+#define ALLCPUS     ((1L << NCPU) - 1)
+
+// A page-aligned region of user memory whose pages vmfault()
+// allocates, or reads in from a file, when first touched;
+// see vma.c.
+struct vma {
+  enum { VMA_NONE, VMA_ANON, VMA_FILE, VMA_SHM } type;
+  uint64 start;                // first address
+  uint64 end;                  // one past the last address
+  int perm;                    // PTE_R, PTE_W and PTE_X
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  int rdonly;                  // may not be made writable; see mprotect()
+  struct inode *ip;            // VMA_FILE: file the pages come from
+  uint off;                    // VMA_FILE, VMA_SHM: file or segment offset of start
+  uint filesz;                 // VMA_FILE: bytes of file data; the rest reads as zero
+  int shmid;                   // VMA_SHM: shared memory segment; see shm.c
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -91,17 +114,43 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int kpreempted;              // Preempted in the kernel; see procstop()
+  int cpu;                     // CPU it last ran on; its run queue is that CPU's
+  uint64 affinity;             // CPUs it may run on, one bit each; see setaffinity()
+  int nice;                    // -20 (largest CPU share) to 19; see setpriority()
+  uint64 vruntime;             // SCHED_FAIR: CPU time used, weighted by nice
+  uint64 execstart;            // When it was last charged for CPU time
+  uint64 slice;                // CPU time since it was last picked to run
+  int sclass;                  // Scheduling class; see setscheduler()
+  int rtprio;                  // Real-time priority, or 0
+  int prio;                    // rtprio, or more lent by waiters; see prioboost()
+  struct sleeplock *held;      // Sleep-locks it holds, linked through nextheld
+  struct sleeplock *waitlock;  // Sleep-lock it waits for
+
+  // its run queue's lock must be held when using these:
+  struct proc *rqnext;         // SCHED_RR or real time: next on its run queue
+  int rqprio;                  // prio while queued, or -1 if not queued
+  struct proc *rqleft;         // SCHED_FAIR: its run queue's tree
+  struct proc *rqright;
+  int rqheight;
+  uint64 rqweight;             // SCHED_FAIR: weight while queued
+  struct proc *sqnext;         // Next on its sleep queue; see sleep()
+  int onsleepq;                // On a sleep queue
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
+  int vforked;                 // Borrows the parent's address space; see vfork()
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  uint64 asid;                 // Address space id and generation; see vm.c
+  int asidcpu;                 // CPU it last returned to user space on
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Regions of memory; see vma.c
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,11 @@
+// scheduling classes, for setscheduler().
+#define SCHED_OTHER   0   // the boot-time policy; see setpriority()
+#define SCHED_RTFIFO  1   // real time: runs until it sleeps or yields
+#define SCHED_RTRR    2   // real time: takes turns with its equals
+
+#define RTPRIOMAX     99  // highest real-time priority; the lowest is 1
+
+// scheduling policies for SCHED_OTHER, chosen when the
+// kernel is built (make SCHED=RR or FAIR); see scheduler().
+#define SCHED_RR      0   // round robin
+#define SCHED_FAIR    1   // weighted fair shares
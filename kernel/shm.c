@@ -0,0 +1,177 @@
+// System V-style shared memory segments.
+//
+// A segment is a set of physical pages that shmat() maps
+// into the address space of every process that attaches
+// it, as a VMA_SHM region (see vma.c), so processes can
+// exchange data without copying it through the kernel.
+// Pages are allocated when first touched.
+//
+// A segment lives until shmctl(IPC_RMID) has been called
+// and no region maps it any more. Each region that maps a
+// segment counts as a reference: fork() and splitting a
+// region call shmdup(); unmapping one calls shmput().
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "mman.h"
+
+struct shm {
+  int used;
+  int key;
+  int ref;             // regions that map the segment
+  int removed;         // shmctl(IPC_RMID) was called
+  uint npages;
+  uint64 *pages;       // a page of physical page addresses; 0 if not yet touched
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Free segment s's pages. Caller must hold shmtab.lock.
+static void
+shmfree(struct shm *s)
+{
+  for(int i = 0; i < s->npages; i++)
+    if(s->pages[i])
+      kfree((void*)s->pages[i]);
+  kfree(s->pages);
+  memset(s, 0, sizeof(*s));
+}
+
+// Return the id of the segment with the given key, creating
+// one of size bytes if there is none and flags has IPC_CREAT.
+// Key IPC_PRIVATE always creates a new segment.
+// Returns -1 on failure.
+int
+shmget(int key, uint64 size, int flags)
+{
+  struct shm *s, *free = 0;
+  int id = -1;
+
+  if(size == 0 || size > (PGSIZE / sizeof(uint64)) * PGSIZE)
+    return -1;
+
+  acquire(&shmtab.lock);
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++){
+    if(!s->used){
+      if(free == 0)
+        free = s;
+    } else if(key != IPC_PRIVATE && s->key == key && !s->removed){
+      if(size <= s->npages * PGSIZE)
+        id = s - shmtab.shm;
+      goto out;
+    }
+  }
+  if((flags & IPC_CREAT) == 0 || free == 0)
+    goto out;
+  if((free->pages = kalloc_zeroed()) == 0)
+    goto out;
+  free->used = 1;
+  free->key = key;
+  free->npages = PGROUNDUP(size) / PGSIZE;
+  id = free - shmtab.shm;
+
+ out:
+  release(&shmtab.lock);
+  return id;
+}
+
+// Count a new region that maps segment id, for shmat().
+// Returns the size of the segment in bytes, or 0 if there
+// is no such segment.
+uint64
+shmattach(int id)
+{
+  struct shm *s;
+  uint64 size = 0;
+
+  if(id < 0 || id >= NSHM)
+    return 0;
+  s = &shmtab.shm[id];
+  acquire(&shmtab.lock);
+  if(s->used && !s->removed){
+    s->ref++;
+    size = s->npages * PGSIZE;
+  }
+  release(&shmtab.lock);
+  return size;
+}
+
+// Return page n of segment id with a reference taken for
+// the caller, allocating a zeroed page on first use.
+// Returns 0 if out of memory.
+void*
+shmpage(int id, uint n)
+{
+  struct shm *s = &shmtab.shm[id];
+  uint64 pa;
+
+  acquire(&shmtab.lock);
+  if(!s->used || n >= s->npages)
+    panic("shmpage");
+  if(s->pages[n] == 0)
+    s->pages[n] = (uint64)kalloc_zeroed();
+  if((pa = s->pages[n]) != 0)
+    kref((void*)pa);
+  release(&shmtab.lock);
+  return (void*)pa;
+}
+
+// Count another region that maps segment id.
+void
+shmdup(int id)
+{
+  acquire(&shmtab.lock);
+  if(!shmtab.shm[id].used)
+    panic("shmdup");
+  shmtab.shm[id].ref++;
+  release(&shmtab.lock);
+}
+
+// A region that mapped segment id is gone.
+void
+shmput(int id)
+{
+  struct shm *s = &shmtab.shm[id];
+
+  acquire(&shmtab.lock);
+  if(!s->used || s->ref < 1)
+    panic("shmput");
+  if(--s->ref == 0 && s->removed)
+    shmfree(s);
+  release(&shmtab.lock);
+}
+
+// Only IPC_RMID is supported: mark segment id to be
+// freed once no region maps it.
+// Returns 0 on success, -1 on failure.
+int
+shmctl(int id, int cmd)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM || cmd != IPC_RMID)
+    return -1;
+  s = &shmtab.shm[id];
+  acquire(&shmtab.lock);
+  if(!s->used || s->removed){
+    release(&shmtab.lock);
+    return -1;
+  }
+  s->removed = 1;
+  if(s->ref == 0)
+    shmfree(s);
+  release(&shmtab.lock);
+  return 0;
+}
@@ -0,0 +1,212 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// A kmem_cache hands out objects of one size, carved from
+// pages it gets from kalloc(). Each page is a slab: a
+// struct slab header followed by as many objects as fit. A
+// cache keeps the slabs that have free objects on a list,
+// and returns a slab's page to kalloc() once all of its
+// objects are free again.
+//
+// In front of the slabs, each CPU has a magazine: a small
+// stack of free objects that kmem_cache_alloc() and
+// kmem_cache_free() use without taking the cache's lock.
+// An empty magazine is refilled with half a magazine's
+// worth of objects from the slabs; a full one gives half
+// back.
+//
+// Objects are not zeroed, and are 8-byte aligned.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NKCACHE  8    // caches
+#define KMAG     16   // objects per magazine
+
+struct kobj {
+  struct kobj *next;
+};
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;      // list of slabs with free objects
+  struct slab *prev;
+  struct kobj *free;      // free objects in this slab
+  int inuse;              // objects allocated from this slab
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;              // bytes per object
+  uint perslab;           // objects per slab
+  struct spinlock lock;
+  struct slab partial;    // circular list of slabs with free objects
+  struct {
+    int n;
+    void *obj[KMAG];
+  } mag[NCPU];            // per-CPU; used with interrupts off
+
+  // statistics, for kmemdump().
+  uint nslab;             // slabs allocated
+  uint ninuse;            // objects out of the slabs, counting magazines
+};
+
+#define SLABHDR  ((sizeof(struct slab) + 7) & ~7)
+
+static struct kmem_cache kcache[NKCACHE];
+static int nkcache;
+
+// Make a cache of objects of size bytes, named name for
+// kmemdump(). Called during boot.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  if(nkcache == NKCACHE)
+    panic("kmem_cache_create: too many caches");
+  size = (size + 7) & ~7;
+  if(size < sizeof(struct kobj) || size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: size");
+  c = &kcache[nkcache++];
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  initlock(&c->lock, name);
+  c->partial.next = &c->partial;
+  c->partial.prev = &c->partial;
+  return c;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+static void
+slab_push(struct kmem_cache *c, struct slab *s)
+{
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+}
+
+// Take up to n objects from c's slabs into obj[], getting
+// a new slab if there are none with free objects.
+// Returns how many it took. Caller must hold c->lock.
+static int
+slab_take(struct kmem_cache *c, void **obj, int n)
+{
+  struct slab *s;
+  struct kobj *o;
+  char *p;
+  int i;
+
+  for(i = 0; i < n; ){
+    if((s = c->partial.next) == &c->partial){
+      if((s = kalloc()) == 0)
+        break;
+      s->cache = c;
+      s->free = 0;
+      s->inuse = 0;
+      for(p = (char*)s + SLABHDR; p + c->size <= (char*)s + PGSIZE; p += c->size){
+        o = (struct kobj*)p;
+        o->next = s->free;
+        s->free = o;
+      }
+      slab_push(c, s);
+      c->nslab++;
+    }
+    while(i < n && s->free){
+      o = s->free;
+      s->free = o->next;
+      s->inuse++;
+      obj[i++] = o;
+    }
+    if(s->free == 0)
+      slab_unlink(s);
+  }
+  c->ninuse += i;
+  return i;
+}
+
+// Return the n objects in obj[] to their slabs, freeing
+// slabs that become empty. Caller must hold c->lock.
+static void
+slab_give(struct kmem_cache *c, void **obj, int n)
+{
+  struct slab *s;
+  struct kobj *o;
+
+  for(int i = 0; i < n; i++){
+    o = obj[i];
+    s = (struct slab*)PGROUNDDOWN((uint64)o);
+    if(s->cache != c)
+      panic("kmem_cache_free: wrong cache");
+    if(s->free == 0)
+      slab_push(c, s);
+    o->next = s->free;
+    s->free = o;
+    if(--s->inuse == 0){
+      slab_unlink(s);
+      kfree(s);
+      c->nslab--;
+    }
+  }
+  c->ninuse -= n;
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj = 0;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == 0){
+    acquire(&c->lock);
+    c->mag[id].n = slab_take(c, c->mag[id].obj, KMAG/2);
+    release(&c->lock);
+  }
+  if(c->mag[id].n > 0)
+    obj = c->mag[id].obj[--c->mag[id].n];
+  pop_off();
+  return obj;
+}
+
+// Free obj, which came from cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == KMAG){
+    acquire(&c->lock);
+    slab_give(c, &c->mag[id].obj[KMAG/2], KMAG/2);
+    release(&c->lock);
+    c->mag[id].n = KMAG/2;
+  }
+  c->mag[id].obj[c->mag[id].n++] = obj;
+  pop_off();
+}
+
+// Print each cache's usage; see kallocdump().
+void
+kmemdump(void)
+{
+  struct kmem_cache *c;
+
+  for(c = kcache; c < &kcache[nkcache]; c++)
+    printf("slab %s: %d objects of %d bytes in %d slabs\n",
+           c->name, c->ninuse, c->size, c->nslab);
+}
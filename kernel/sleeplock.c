@@ -16,6 +16,8 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->holder = 0;
+  lk->waitprio = 0;
 }
 
 void
@@ -23,10 +25,13 @@ acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   while (lk->locked) {
+    priowait(lk);
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->holder = myproc();
+  priohold(lk);
   release(&lk->lk);
 }
 
@@ -34,9 +39,11 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  priorelease(lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  lk->holder = 0;
+  wakeupone(lk);
   release(&lk->lk);
 }
 
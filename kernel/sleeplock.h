@@ -3,6 +3,11 @@ struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
   
+  // For priority inheritance; see priowait():
+  struct proc *holder;          // Process holding lock
+  int waitprio;                 // Highest priority of its waiters
+  struct sleeplock *nextheld;   // Next lock its holder holds
+
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
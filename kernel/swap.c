@@ -0,0 +1,247 @@
+// Swapping of user pages to the swap disk.
+//
+// When free memory runs low, swapreclaim() evicts user
+// pages that have not been used lately, so that programs
+// that together need more memory than the machine has slow
+// down rather than fail. An evicted page is compressed into
+// memory by zram.c if it compresses well, and otherwise
+// written to a slot on the swap disk (see virtio_disk.c).
+// Slot numbers from NSWAP up are zram.c's slots.
+//
+// Victims are chosen by a clock: a hand sweeps over the user
+// pages of each process in turn. A page whose PTE_A bit is
+// set has been used since the hand last passed; the hand
+// clears the bit and moves on. A page with PTE_A clear is
+// evicted, unless it is shared, with another process after
+// fork() or with the page cache or a shared memory segment:
+// only pages with a single reference are evicted. An unused
+// megapage is split, and evicted a page at a time.
+//
+// An evicted page's PTE is left invalid, with PTE_SWAP and
+// its permission bits set and the slot number in place of
+// the physical page number. vmfault() calls swapin() to
+// read the page back when it is next touched. fork() shares
+// the slot between parent and child (swapdup()), and each
+// reads its own copy back.
+//
+// The hand does not flush the TLB after clearing PTE_A, so
+// a page whose translation stays cached may look unused a
+// little early.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define SLOTSECTORS (PGSIZE / 512)
+#define ZSLOT(i) (NSWAP + (i))  // zram.c's slot i
+
+struct {
+  struct sleeplock lock;  // one evictor at a time; protects the hand
+  struct spinlock slotlock;
+  uint nslot;             // slots on the swap disk; 0 if none
+  uchar ref[NSWAP];       // PTEs that refer to each slot; 0 if free
+  int hand;               // process the clock hand is at
+  uint64 va;              // and the address in it
+  uint nused;             // statistics, for swapdump()
+  uint nout;
+  uint nin;
+} swap;
+
+void
+swapinit(void)
+{
+  uint64 n;
+
+  initsleeplock(&swap.lock, "swap");
+  initlock(&swap.slotlock, "swapslot");
+  n = virtio_swap_init() / SLOTSECTORS;
+  swap.nslot = n > NSWAP ? NSWAP : n;
+}
+
+// Allocate a swap slot. Returns -1 if the disk is full.
+static int
+slotalloc(void)
+{
+  int slot = -1;
+
+  acquire(&swap.slotlock);
+  for(int i = 0; i < swap.nslot; i++){
+    if(swap.ref[i] == 0){
+      swap.ref[i] = 1;
+      swap.nused++;
+      slot = i;
+      break;
+    }
+  }
+  release(&swap.slotlock);
+  return slot;
+}
+
+// Another PTE refers to slot, for fork().
+void
+swapdup(uint slot)
+{
+  if(slot >= NSWAP){
+    zdup(slot - NSWAP);
+    return;
+  }
+  acquire(&swap.slotlock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.slotlock);
+}
+
+// A PTE that referred to slot is gone.
+void
+swapfree(uint slot)
+{
+  if(slot >= NSWAP){
+    zfree(slot - NSWAP);
+    return;
+  }
+  acquire(&swap.slotlock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.slotlock);
+}
+
+// Find the first user page or megapage mapped at or above
+// *va in pagetable, set *va to its address and *level to
+// its level, and return its PTE. Returns 0 if there is none.
+static pte_t*
+nextpage(pagetable_t pagetable, uint64 *va, int *level)
+{
+  pagetable_t pt;
+  pte_t *pte;
+  uint64 a;
+  int l = 0;
+
+  for(a = *va; a < MAXVA; a = (a + LEVELSIZE(l)) & ~(LEVELSIZE(l) - 1)){
+    pt = pagetable;
+    for(l = 2; ; l--){
+      pte = &pt[PX(l, a)];
+      if(l == 0 || (*pte & PTE_V) == 0 || PTE_LEAF(*pte))
+        break;
+      pt = (pagetable_t)PTE2PA(*pte);
+    }
+    if((*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) && l < 2){
+      *va = a & ~(LEVELSIZE(l) - 1);
+      *level = l;
+      return pte;
+    }
+  }
+  return 0;
+}
+
+// Move the clock hand on to a page to evict, and evict it.
+// Returns 0 on success, -1 if a full sweep found no page
+// that could be evicted. Caller must hold swap.lock.
+static int
+evict(void)
+{
+  pagetable_t pagetable;
+  pte_t *pte;
+  uint64 pa;
+  int i, level, slot;
+
+  // two full sweeps, since the first may only clear PTE_A.
+  for(i = 0; i <= 2*NPROC; i++){
+    if((pagetable = procstop(swap.hand)) != 0){
+      while((pte = nextpage(pagetable, &swap.va, &level)) != 0){
+        pa = PTE2PA(*pte);
+        if(*pte & PTE_A){
+          // used since the hand last passed.
+          __sync_fetch_and_and(pte, ~PTE_A);
+        } else if(level > 0){
+          if(uvmsplit(pagetable, swap.va) == 0)
+            continue;
+        } else if(krefcount((void*)pa) == 1){
+          if((slot = zstore((void*)pa)) >= 0){
+            slot = ZSLOT(slot);
+          } else if((slot = slotalloc()) >= 0){
+            virtio_swap_rw((uint64)slot * SLOTSECTORS, (void*)pa, 1);
+          } else {
+            // incompressible and no swap slot: keep
+            // looking for a page that will compress.
+            swap.va += PGSIZE;
+            continue;
+          }
+          *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SWAP;
+          swap.va += PGSIZE;
+          procresume(pagetable, 1);
+          kfree((void*)pa);
+          swap.nout++;
+          return 0;
+        }
+        swap.va += LEVELSIZE(level);
+      }
+      procresume(pagetable, 0);
+    }
+    swap.hand = (swap.hand + 1) % NPROC;
+    swap.va = 0;
+  }
+  return -1;
+}
+
+// If free memory is low, evict pages until there is a
+// comfortable amount again. Called before a process
+// allocates memory for itself; may sleep, so the caller
+// must not hold a spinlock.
+void
+swapreclaim(void)
+{
+  if(kfreecount() >= SWAPLOW)
+    return;
+  reapwait();
+  if(kfreecount() >= SWAPLOW)
+    return;
+  acquiresleep(&swap.lock);
+  while(kfreecount() < 2*SWAPLOW && evict() == 0)
+    ;
+  releasesleep(&swap.lock);
+}
+
+// Read back the evicted page that the PTE_SWAP pte maps at
+// va in pagetable, and map it again.
+// Returns 0 on success, -1 if out of memory.
+int
+swapin(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  pte_t old = *pte;
+  uint slot = PTE2SLOT(old);
+  uint64 flags;
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  if(slot >= NSWAP)
+    zload(slot - NSWAP, mem);
+  else
+    virtio_swap_rw((uint64)slot * SLOTSECTORS, mem, 0);
+
+  // the page is the process's own now, even if it was
+  // copy-on-write when evicted.
+  flags = (PTE_FLAGS(old) & ~(PTE_SWAP|PTE_COW)) | PTE_V;
+  if(old & PTE_COW)
+    flags |= PTE_W;
+  *pte = PA2PTE(mem) | flags;
+  tlbflush(pagetable, va);
+  swapfree(slot);
+  __sync_fetch_and_add(&swap.nin, 1);
+  return 0;
+}
+
+// Print swap statistics; see kallocdump().
+void
+swapdump(void)
+{
+  printf("swap: %d of %d slots used, %d pages out, %d in\n",
+         swap.nused, swap.nslot, swap.nout, swap.nin);
+  zramdump();
+}
@@ -20,3 +20,18 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_mmap   22
+#define SYS_munmap 23
+#define SYS_mprotect 24
+#define SYS_msync  25
+#define SYS_shmget 26
+#define SYS_shmat  27
+#define SYS_shmdt  28
+#define SYS_shmctl 29
+#define SYS_spawn  30
+#define SYS_vfork  31
+#define SYS_setpriority 32
+#define SYS_setscheduler 33
+#define SYS_setaffinity 34
+#define SYS_getaffinity 35
+#define SYS_getcpu 36
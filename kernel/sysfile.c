@@ -431,24 +431,22 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Fetch the user argument vector at uargv into argv[],
+// a page for each string. Returns 0 on success, -1 on
+// failure; either way, freeargv() frees what was fetched.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -456,22 +454,77 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
-
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
 
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  ret = -1;
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(myproc(), path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fds, nfd): run path in a new process
+// whose descriptor i is a copy of the caller's fds[i], or
+// closed if fds[i] is -1, for i < nfd. If fds is 0, the
+// child gets all of the caller's open files.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct file *ofile[NOFILE];
+  uint64 uargv, ufds;
+  int i, fd, nfd, ret;
+  struct proc *p = myproc();
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufds);
+  argint(3, &nfd);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if(ufds == 0){
+    memmove(ofile, p->ofile, sizeof(ofile));
+  } else {
+    if(nfd < 0 || nfd > NOFILE)
+      return -1;
+    memset(ofile, 0, sizeof(ofile));
+    for(i = 0; i < nfd; i++){
+      if(copyin(p->pagetable, (char*)&fd, ufds + i*sizeof(int), sizeof(int)) < 0)
+        return -1;
+      if(fd == -1)
+        continue;
+      if(fd < 0 || fd >= NOFILE || p->ofile[fd] == 0)
+        return -1;
+      ofile[i] = p->ofile[fd];
+    }
+  }
+  ret = -1;
+  if(fetchargv(uargv, argv) == 0)
+    ret = spawn(path, argv, ofile);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -27,6 +27,12 @@ sys_fork(void)
   return fork();
 }
 
+uint64
+sys_vfork(void)
+{
+  return vfork();
+}
+
 uint64
 sys_wait(void)
 {
@@ -48,6 +54,101 @@ sys_sbrk(void)
   return addr;
 }
 
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len;
+  int prot, flags, fd, off;
+  struct file *f = 0;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(4, &fd);
+  argint(5, &off);
+  if(fd >= 0 && fd < NOFILE)
+    f = myproc()->ofile[fd];
+  if(off < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
+
+uint64
+sys_mprotect(void)
+{
+  uint64 addr, len;
+  int prot;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  argint(2, &prot);
+  return mprotect(addr, len, prot);
+}
+
+uint64
+sys_msync(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return msync(addr, len);
+}
+
+uint64
+sys_shmget(void)
+{
+  uint64 size;
+  int key, flags;
+
+  argint(0, &key);
+  argaddr(1, &size);
+  argint(2, &flags);
+  return shmget(key, size, flags);
+}
+
+uint64
+sys_shmat(void)
+{
+  uint64 addr;
+  int id, flags;
+
+  argint(0, &id);
+  argaddr(1, &addr);
+  argint(2, &flags);
+  return shmat(id, addr, flags);
+}
+
+uint64
+sys_shmdt(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return shmdt(addr);
+}
+
+uint64
+sys_shmctl(void)
+{
+  int id, cmd;
+
+  argint(0, &id);
+  argint(1, &cmd);
+  return shmctl(id, cmd);
+}
+
 uint64
 sys_sleep(void)
 {
@@ -77,6 +178,60 @@ sys_kill(void)
   return kill(pid);
 }
 
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return setpriority(pid, nice);
+}
+
+uint64
+sys_setscheduler(void)
+{
+  int pid, sclass, prio;
+
+  argint(0, &pid);
+  argint(1, &sclass);
+  argint(2, &prio);
+  return setscheduler(pid, sclass, prio);
+}
+
+uint64
+sys_setaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  argint(0, &pid);
+  argaddr(1, &mask);
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_getaffinity(void)
+{
+  int pid;
+  uint64 addr, mask;
+
+  argint(0, &pid);
+  argaddr(1, &addr);
+  if(getaffinity(pid, &mask) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&mask, sizeof(mask)) < 0)
+    return -1;
+  return 0;
+}
+
+// return the CPU the caller is running on.
+uint64
+sys_getcpu(void)
+{
+  return myproc()->cpu;
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
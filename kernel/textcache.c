@@ -0,0 +1,237 @@
+// Executable image and shared file page cache.
+//
+// Keeps physical pages of files, keyed by the device, inode
+// number and file offset they were read from, so that
+// processes mapping the same part of a file map the same
+// pages instead of reading in their own copies. There are
+// two kinds of page:
+//
+// * text pages hold read-only program segments and other
+//   read-only private mappings. Since the page of the last
+//   segment is zero beyond the segment's data, the number n
+//   of bytes of file data is part of the key.
+//   writei() drops them, so that a changed file is read in
+//   again by later processes.
+// * shared pages back MAP_SHARED mappings, and are what
+//   every such mapping of the file sees. writei() copies
+//   newly written data into them, and vma.c writes pages
+//   that a mapping has dirtied back to the file. They are
+//   not limited to NTEXTPAGE: vma.c keeps them as long as
+//   any region maps the file, and then drops them all with
+//   textinval(), so that every mapper sees the same page.
+//
+// Interface:
+// * vmfault() calls textget() before reading in a page of a
+//   mapped file, and textput() after.
+// * writei() calls textwrite() and textinval(); itrunc()
+//   calls textinval() to drop the text pages of the file
+//   and textzero() to empty its shared ones.
+//
+// The cache holds a reference (see kref()) on each page it
+// keeps; the page stays allocated while any process maps
+// it. When the text entries are all taken, one that no
+// process is using any more is recycled.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+struct tpage {
+  uint dev;
+  uint inum;
+  uint off;            // file offset of the page's data
+  uint n;              // text: bytes of file data; the rest is zero
+  int shared;          // a MAP_SHARED page rather than a text page
+  uint64 pa;           // the page; 0 if the entry is free
+  struct tpage *next;  // hash chain
+};
+
+#define NTEXTHASH 61
+#define TEXTHASH(dev, inum) (((dev) * 31 + (inum)) % NTEXTHASH)
+
+struct {
+  struct spinlock lock;
+  struct tpage page[NTEXTPAGE];  // text pages
+  struct kmem_cache *shared;     // shared pages' entries
+  struct tpage *hash[NTEXTHASH];
+  int hand;            // next entry for textput() to consider
+  int nshared;         // shared pages
+  uint nhit;
+  uint nmiss;
+} tcache;
+
+void
+textinit(void)
+{
+  initlock(&tcache.lock, "tcache");
+  tcache.shared = kmem_cache_create("tpage", sizeof(struct tpage));
+}
+
+// Remove t from its hash chain and drop the cache's
+// reference to its page. Caller must hold tcache.lock.
+static void
+tunlink(struct tpage *t)
+{
+  struct tpage **pp;
+
+  for(pp = &tcache.hash[TEXTHASH(t->dev, t->inum)]; *pp != t; pp = &(*pp)->next)
+    ;
+  *pp = t->next;
+  kfree((void*)t->pa);
+  t->pa = 0;
+  if(t->shared){
+    kmem_cache_free(tcache.shared, t);
+    tcache.nshared--;
+  }
+}
+
+static struct tpage*
+tlookup(uint dev, uint inum, uint off, int shared)
+{
+  struct tpage *t;
+
+  for(t = tcache.hash[TEXTHASH(dev, inum)]; t; t = t->next){
+    if(t->dev == dev && t->inum == inum && t->off == off && t->shared == shared)
+      return t;
+  }
+  return 0;
+}
+
+// Return the cached page of inode (dev, inum) at offset off,
+// with a reference taken for the caller, or 0 if it is not
+// cached. For a text page, n is the number of bytes of
+// file data it must hold.
+void*
+textget(uint dev, uint inum, uint off, uint n, int shared)
+{
+  struct tpage *t;
+  uint64 pa = 0;
+
+  acquire(&tcache.lock);
+  t = tlookup(dev, inum, off, shared);
+  if(t && (shared || t->n == n)){
+    pa = t->pa;
+    kref((void*)pa);
+    tcache.nhit++;
+  } else {
+    tcache.nmiss++;
+  }
+  release(&tcache.lock);
+  return (void*)pa;
+}
+
+// Offer the page pa, just read in, to the cache. The caller
+// keeps its own reference.
+// Returns 0 if pa is now cached; -1 if another page is
+// cached at off already, or, for a text page, if every text
+// entry is in use, or, for a shared page, if out of memory.
+int
+textput(uint dev, uint inum, uint off, uint n, int shared, void *pa)
+{
+  struct tpage *t;
+  int i;
+
+  acquire(&tcache.lock);
+  if(tlookup(dev, inum, off, shared) != 0){
+    release(&tcache.lock);
+    return -1;
+  }
+  if(shared){
+    if((t = kmem_cache_alloc(tcache.shared)) == 0){
+      release(&tcache.lock);
+      return -1;
+    }
+    tcache.nshared++;
+  } else {
+    for(i = 0; i < NTEXTPAGE; i++){
+      t = &tcache.page[tcache.hand];
+      tcache.hand = (tcache.hand + 1) % NTEXTPAGE;
+      if(t->pa == 0)
+        break;
+      if(krefcount((void*)t->pa) == 1){
+        tunlink(t);
+        break;
+      }
+    }
+    if(i == NTEXTPAGE){
+      release(&tcache.lock);
+      return -1;
+    }
+  }
+  kref(pa);
+  t->dev = dev;
+  t->inum = inum;
+  t->off = off;
+  t->n = n;
+  t->shared = shared;
+  t->pa = (uint64)pa;
+  t->next = tcache.hash[TEXTHASH(dev, inum)];
+  tcache.hash[TEXTHASH(dev, inum)] = t;
+  release(&tcache.lock);
+  return 0;
+}
+
+// writei() has written the n bytes at src to inode
+// (dev, inum) at offset off; copy them into the shared
+// page that holds them, if it is cached. The n bytes
+// must not cross a page boundary.
+void
+textwrite(uint dev, uint inum, uint off, char *src, uint n)
+{
+  struct tpage *t;
+
+  acquire(&tcache.lock);
+  if((t = tlookup(dev, inum, PGROUNDDOWN(off), 1)) != 0)
+    memmove((char*)t->pa + off % PGSIZE, src, n);
+  release(&tcache.lock);
+}
+
+// Forget the cached text pages of inode (dev, inum), whose
+// contents have changed, and its shared pages too if all
+// is set, which vma.c does once no region maps the file.
+// Processes that map them already keep them.
+void
+textinval(uint dev, uint inum, int all)
+{
+  struct tpage *t, *next;
+
+  acquire(&tcache.lock);
+  for(t = tcache.hash[TEXTHASH(dev, inum)]; t; t = next){
+    next = t->next;
+    if(t->dev == dev && t->inum == inum && (all || !t->shared))
+      tunlink(t);
+  }
+  release(&tcache.lock);
+}
+
+// itrunc() has emptied inode (dev, inum): zero its shared
+// pages, which regions may still map, rather than drop
+// them, so that every mapping goes on seeing the same page.
+void
+textzero(uint dev, uint inum)
+{
+  struct tpage *t;
+
+  acquire(&tcache.lock);
+  for(t = tcache.hash[TEXTHASH(dev, inum)]; t; t = t->next)
+    if(t->dev == dev && t->inum == inum && t->shared)
+      memset((void*)t->pa, 0, PGSIZE);
+  release(&tcache.lock);
+}
+
+// Print page cache statistics; see kallocdump().
+void
+textdump(void)
+{
+  int n = 0;
+
+  acquire(&tcache.lock);
+  for(int i = 0; i < NTEXTPAGE; i++)
+    if(tcache.page[i].pa)
+      n++;
+  printf("page cache: %d text pages, %d shared, %u hits, %u misses\n",
+         n, tcache.nshared, tcache.nhit, tcache.nmiss);
+  release(&tcache.lock);
+}
@@ -67,6 +67,21 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // instruction, load or store page fault on a lazily
+    // allocated, copy-on-write or not yet read-in page.
+    // reading the page in may sleep, so save scause and
+    // stval before enabling interrupts.
+    uint64 scause = r_scause();
+    uint64 stval = r_stval();
+
+    intr_on();
+
+    if(vmfault(p->pagetable, stval, scause == 15) < 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      setkilled(p);
+    }
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -76,8 +91,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is a timer interrupt
+  // and the scheduler says it is time.
+  if(which_dev == 2 && schedtick())
     yield();
 
   usertrapret();
@@ -119,8 +135,9 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // and the address space id to tag its TLB entries with.
+  uint64 satp = asidswitch(p);
 
   // jump to userret in trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -129,6 +146,24 @@ usertrapret(void)
   ((void (*)(uint64))trampoline_userret)(satp);
 }
 
+// usercopy.S's table of instructions that use user memory,
+// each with where to go if it faults.
+extern struct {
+  uint64 insn;
+  uint64 fixup;
+} extable[], extable_end[];
+
+// Return the fixup for a page fault at kernel pc sepc,
+// or 0 if there is none.
+static uint64
+uaccessfixup(uint64 sepc)
+{
+  for(int i = 0; &extable[i] < extable_end; i++)
+    if(extable[i].insn == sepc)
+      return extable[i].fixup;
+  return 0;
+}
+
 // interrupts and exceptions from kernel code go here via kernelvec,
 // on whatever the current kernel stack is.
 void 
@@ -138,6 +173,7 @@ kerneltrap()
   uint64 sepc = r_sepc();
   uint64 sstatus = r_sstatus();
   uint64 scause = r_scause();
+  uint64 fixup;
   
   if((sstatus & SSTATUS_SPP) == 0)
     panic("kerneltrap: not from supervisor mode");
@@ -145,14 +181,31 @@ kerneltrap()
     panic("kerneltrap: interrupts enabled");
 
   if((which_dev = devintr()) == 0){
-    printf("scause %p\n", scause);
-    printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
-    panic("kerneltrap");
+    // a page fault in usercopy.S continues at its fixup,
+    // which makes the copy fail.
+    if((scause == 13 || scause == 15) && (fixup = uaccessfixup(sepc)) != 0){
+      sepc = fixup;
+    } else {
+      printf("scause %p\n", scause);
+      printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
+      panic("kerneltrap");
+    }
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // swap.c leaves the process's memory alone meanwhile,
+  // since it may be in the middle of using it. other
+  // processes must not run with SUM set, and a copy to or
+  // from user memory that was interrupted needs the window.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING &&
+     schedtick()){
+    myproc()->kpreempted = 1;
+    w_sstatus(sstatus & ~SSTATUS_SUM);
     yield();
+    if(sstatus & SSTATUS_SUM)
+      uwinset(myproc()->pagetable);
+    myproc()->kpreempted = 0;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -190,6 +243,8 @@ devintr()
       uartintr();
     } else if(irq == VIRTIO0_IRQ){
       virtio_disk_intr();
+    } else if(irq == VIRTIO1_IRQ){
+      virtio_swap_intr();
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
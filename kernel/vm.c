@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -27,13 +29,16 @@ kvmmake(void)
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
-  // virtio mmio disk interface
+  // virtio mmio disk interfaces
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO1, VIRTIO1, PGSIZE, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
   // map kernel text executable and read-only.
+  // kernel.ld aligns etext to 2 MiB so that this and the
+  // mapping below need only megapages.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
@@ -41,7 +46,9 @@ kvmmake(void)
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
-  kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+  // every user page table maps it there too, so it is
+  // global; see proc_pagetable().
+  kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X | PTE_G);
 
   // allocate and map a kernel stack for each process.
   proc_mapstacks(kpgtbl);
@@ -56,23 +63,266 @@ kvminit(void)
   kernel_pagetable = kvmmake();
 }
 
-// Switch h/w page table register to the kernel's page table,
-// and enable paging.
+// Switch h/w page table register to this CPU's copy of the
+// kernel's page table, and enable paging.
 void
 kvminithart()
 {
+  struct cpu *c = mycpu();
+
+  // each CPU has its own top-level page, for its window
+  // onto user memory; the rest is the kernel's.
+  if((c->kpagetable = (pagetable_t) kalloc()) == 0)
+    panic("kvminithart");
+  memmove(c->kpagetable, kernel_pagetable, PGSIZE);
+  c->uwin = 0;
+
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(c->kpagetable));
 
   // flush stale entries from the TLB.
   sfence_vma();
+  mycpu()->asidgen = 0;
+}
+
+// Address space ids.
+//
+// Each process runs in user space with an ASID in satp, so
+// that its TLB entries are told apart from the kernel's,
+// which use ASID 0, and from other processes'. Neither trap
+// entry nor return then has to flush the TLB; instead, code
+// that changes a mapping flushes that address (tlbflush()).
+//
+// ASIDs are handed out in order. When they run out, a new
+// generation starts and numbering begins again; each CPU
+// flushes its whole TLB before it first uses an ASID of the
+// new generation, and a process whose ASID is from an old
+// generation gets a new one. p->asid holds the generation
+// in the bits above ASIDBITS, and is 0 if p has none.
+//
+// A process's TLB entries are kept up to date only on the
+// CPU where it last returned to user space, p->asidcpu;
+// other CPUs flush its ASID before running it.
+
+#define ASIDBITS 16
+#define ASIDNUM(a) ((a) & ((1L << ASIDBITS) - 1))
+
+struct {
+  struct spinlock lock;
+  uint64 gen;       // current generation, << ASIDBITS
+  uint64 next;      // next unused ASID of this generation
+  uint64 max;       // largest ASID; 0 if the hart has none
+} asids;
+
+// Find out how many ASID bits the hardware implements,
+// by writing ones to satp's ASID field and reading it back.
+void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+
+  initlock(&asids.lock, "asid");
+  w_satp(satp | SATP_ASIDMASK);
+  asids.max = (r_satp() & SATP_ASIDMASK) >> SATP_ASIDSHIFT;
+  w_satp(satp);
+  sfence_vma();
+  asids.gen = 1L << ASIDBITS;
+  asids.next = 1;
+}
+
+// Return the satp value for returning p to user space on
+// this CPU. Gives p an ASID of the current generation if it
+// has none, and flushes whatever stale TLB entries this
+// CPU might hold for it. Called with interrupts off.
+uint64
+asidswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint64 gen;
+  int fresh = 0;
+
+  // without ASIDs, userret flushes the TLB every time.
+  if(asids.max == 0)
+    return MAKE_SATP(p->pagetable);
+
+  gen = __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE);
+  if((p->asid & ~ASIDNUM(p->asid)) != gen){
+    acquire(&asids.lock);
+    if(asids.next > asids.max){
+      __atomic_store_n(&asids.gen, asids.gen + (1L << ASIDBITS), __ATOMIC_RELEASE);
+      asids.next = 1;
+    }
+    gen = asids.gen;
+    p->asid = gen | asids.next++;
+    release(&asids.lock);
+    fresh = 1;
+  }
+
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  } else if(!fresh && p->asidcpu != cpuid()){
+    sfence_vma_asid(ASIDNUM(p->asid));
+  }
+  p->asidcpu = cpuid();
+  return MAKE_SATP(p->pagetable) | SATP_ASID(ASIDNUM(p->asid));
+}
+
+// The mapping of user address va in pagetable has changed;
+// make sure no TLB holds the old one. Only the current
+// process's page table can have entries in this CPU's TLB
+// that it will use; if the process's entries may be on
+// another CPU, it just gets a new ASID.
+void
+tlbflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+
+  push_off();
+  if(mycpu()->uwin == pagetable)
+    sfence_vma_va(UWIN(va), 0);
+  pop_off();
+
+  if(p == 0 || p->pagetable != pagetable || p->asid == 0)
+    return;
+  push_off();
+  if(p->asidcpu == cpuid())
+    sfence_vma_va(va, ASIDNUM(p->asid));
+  else
+    p->asid = 0;
+  pop_off();
+}
+
+// Like tlbflush(), for all of pagetable, after page-table
+// pages have been taken out of it: the TLB may hold the
+// page-table entries on the way to a page as well as the
+// page's own, and flushing an address only flushes the
+// latter.
+static void
+tlbflushall(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  uwinclear(pagetable);
+  if(p == 0 || p->pagetable != pagetable || p->asid == 0)
+    return;
+  push_off();
+  if(p->asidcpu == cpuid())
+    sfence_vma_asid(ASIDNUM(p->asid));
+  else
+    p->asid = 0;
+  pop_off();
+}
+
+// The window onto user memory.
+//
+// User addresses overlap the kernel's own, so the kernel
+// cannot simply use the user page table's mappings as they
+// are. Instead, the upper half of each CPU's kernel page
+// table (top-level entries 256-511, which the kernel does
+// not otherwise use) holds a copy of the lower half of the
+// current process's: user address va appears at UWIN(va),
+// and copyin() and copyout() use user memory directly,
+// with sstatus.SUM set, rather than walking the page table.
+//
+// Only the top level is copied, so the window sees changes
+// to the process's mappings at once, except for page-table
+// pages added at the top level; a copy that faults on one
+// calls uwinsync() to update the window. The TLB entries
+// for the window have ASID 0, like the kernel's, so
+// tlbflush() flushes them too.
+//
+// The window stays up when the process gives up the CPU,
+// and is still good when it runs here again if the TLB's
+// entries for its ASID are: if it has the same ASID, and
+// this is the CPU it last returned to user space on (see
+// asidswitch()). Otherwise showing it again flushes the
+// kernel's TLB entries.
+
+// Show the current process's pagetable in this CPU's window
+// onto user memory, unless it is there already.
+void
+uwinset(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  if(c->uwin != pagetable || c->uwinasid != p->asid ||
+     p->asid == 0 || p->asidcpu != cpuid()){
+    memmove(&c->kpagetable[256], pagetable, 256 * sizeof(pte_t));
+    sfence_vma_asid(0);
+    c->uwin = pagetable;
+    c->uwinasid = p->asid;
+  }
+  pop_off();
+}
+
+// A copy through the window faulted; pick up any page-table
+// pages added at the top level since uwinset().
+static void
+uwinsync(pagetable_t pagetable)
+{
+  struct cpu *c;
+  int changed = 0;
+
+  push_off();
+  c = mycpu();
+  for(int i = 0; i < 256; i++){
+    if(c->kpagetable[256+i] != pagetable[i]){
+      c->kpagetable[256+i] = pagetable[i];
+      changed = 1;
+    }
+  }
+  if(changed)
+    sfence_vma_asid(0);
+  pop_off();
+}
+
+// Take pagetable out of this CPU's window, because it is
+// about to be freed or has lost page-table pages. Another
+// CPU that still shows it rebuilds its window before using
+// it again, since the ASID or the CPU no longer matches;
+// see uwinset().
+void
+uwinclear(pagetable_t pagetable)
+{
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  if(c->uwin == pagetable){
+    memset(&c->kpagetable[256], 0, 256 * sizeof(pte_t));
+    sfence_vma_asid(0);
+    c->uwin = 0;
+  }
+  pop_off();
+}
+
+// Can len bytes at va in pagetable be copied through the
+// window? If so, sets it up.
+static int
+uwinok(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->pagetable != pagetable)
+    return 0;
+  // the trapframe is above MMAPTOP, and not the user's.
+  if(va >= MMAPTOP || len > MMAPTOP - va)
+    return 0;
+  uwinset(pagetable);
+  return 1;
 }
 
 // Return the address of the PTE in page table pagetable
-// that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// that corresponds to virtual address va at the given level:
+// 0 for a 4 KiB page, 1 for a 2 MiB megapage, 2 for a 1 GiB
+// gigapage. If alloc!=0, create any required page-table pages.
+// If va falls in a larger page, return that page's leaf PTE.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -82,57 +332,199 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
-pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int level, int alloc)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
+  return &pagetable[PX(level, va)];
+}
+
+// Return the address of the last-level PTE for va,
+// or the leaf PTE of a larger page that contains va.
+pte_t *
+walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, 0, alloc);
+}
+
+// Return the address of the leaf PTE that maps va, without
+// creating page-table pages, and set *level to the level it
+// sits at. Returns the (possibly invalid) last-level PTE if
+// va is not in a larger page, or 0 if a page-table page on
+// the way is missing.
+static pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, int *level)
+{
+  if(va >= MAXVA)
+    panic("walkleaf");
+
+  for(int l = 2; l > 0; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
+    if((*pte & PTE_V) == 0)
+      return 0;
+    if(PTE_LEAF(*pte)){
+      *level = l;
+      return pte;
+    }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  *level = 0;
   return &pagetable[PX(0, va)];
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
+// Find the first part of [*va, end) that pagetable has
+// page-table pages for, skipping any that are missing, and
+// set *va to its start. Returns its megapage's leaf PTE,
+// with *level set to 1, or its PTE in a last-level
+// page-table page, with *level set to 0; the PTEs that
+// follow it in that page map the rest of its 2 MiB region.
+// Returns 0 if there is nothing left in the range.
+//
+// uvmunmap() and uvmcopy() work through a range with it, a
+// page-table page at a time, rather than walking from the
+// root for every page.
+static pte_t *
+walkrange(pagetable_t pagetable, uint64 *va, uint64 end, int *level)
+{
+  pte_t *pte;
+  uint64 a;
+
+  if(end > MAXVA)
+    panic("walkrange");
+
+  for(a = *va; a < end; ){
+    pte = &pagetable[PX(2, a)];
+    if((*pte & PTE_V) == 0){
+      a = (a + LEVELSIZE(2)) & ~(LEVELSIZE(2) - 1);
+      continue;
+    }
+    if(PTE_LEAF(*pte))
+      panic("walkrange: gigapage");
+    pte = &((pagetable_t)PTE2PA(*pte))[PX(1, a)];
+    if((*pte & PTE_V) == 0){
+      a = (a + MEGAPGSIZE) & ~(MEGAPGSIZE - 1);
+      continue;
+    }
+    *va = a;
+    if(PTE_LEAF(*pte)){
+      *level = 1;
+      return pte;
+    }
+    *level = 0;
+    return &((pagetable_t)PTE2PA(*pte))[PX(0, a)];
+  }
+  *va = end;
+  return 0;
+}
+
+// Does page-table page pt map nothing?
+static int
+ptempty(pagetable_t pt)
+{
+  for(int i = 0; i < 512; i++)
+    if(pt[i] != 0)
+      return 0;
+  return 1;
+}
+
+// Take the last-level page-table page on the way to va
+// out of pagetable if it no longer maps anything, and then
+// the one above it likewise, adding them to the list *dead
+// for the caller to free once it has flushed the TLB.
+static void
+ptprune(pagetable_t pagetable, uint64 va, pagetable_t *dead)
+{
+  pte_t *pte2, *pte1;
+  pagetable_t l1, l0;
+
+  pte2 = &pagetable[PX(2, va)];
+  if((*pte2 & PTE_V) == 0 || PTE_LEAF(*pte2))
+    return;
+  l1 = (pagetable_t)PTE2PA(*pte2);
+  pte1 = &l1[PX(1, va)];
+  if((*pte1 & PTE_V) && !PTE_LEAF(*pte1)){
+    l0 = (pagetable_t)PTE2PA(*pte1);
+    if(!ptempty(l0))
+      return;
+    *pte1 = 0;
+    *(pagetable_t*)l0 = *dead;
+    *dead = l0;
+  }
+  if(ptempty(l1)){
+    *pte2 = 0;
+    *(pagetable_t*)l1 = *dead;
+    *dead = l1;
+  }
+}
+
+// Look up a virtual address, return the physical address
+// of the 4096-byte page that holds it, or 0 if not mapped.
 // Can only be used to look up user pages.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
+  int level;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
-  return pa;
+  return PTE2PA(*pte) + PGROUNDDOWN(va & (LEVELSIZE(level) - 1));
 }
 
-// add a mapping to the kernel page table.
+// add a mapping to the kernel page table, using
+// gigapages and megapages wherever va, pa and the
+// remaining size are suitably aligned.
 // only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 a, last;
+  pte_t *pte;
+  int level;
+
+  if(sz == 0)
+    panic("kvmmap: size");
+
+  a = PGROUNDDOWN(va);
+  pa = PGROUNDDOWN(pa);
+  last = PGROUNDUP(va + sz);
+  while(a < last){
+    for(level = 2; level > 0; level--){
+      if(a % LEVELSIZE(level) == 0 && pa % LEVELSIZE(level) == 0 &&
+         last - a >= LEVELSIZE(level))
+        break;
+    }
+    if((pte = walklevel(kpgtbl, a, level, 1)) == 0)
+      panic("kvmmap");
+    if(*pte & PTE_V)
+      panic("kvmmap: remap");
+    *pte = PA2PTE(pa) | perm | PTE_V;
+    a += LEVELSIZE(level);
+    pa += LEVELSIZE(level);
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -143,7 +535,7 @@ int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
-  pte_t *pte;
+  pte_t *pte = 0;
 
   if(size == 0)
     panic("mappages: size");
@@ -151,43 +543,146 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
-      return -1;
+    // walk once per last-level page-table page.
+    if(pte == 0 || PX(0, a) == 0){
+      if((pte = walk(pagetable, a, 1)) == 0)
+        return -1;
+    }
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
+    tlbflush(pagetable, a);
     if(a == last)
       break;
     a += PGSIZE;
     pa += PGSIZE;
+    pte++;
   }
   return 0;
 }
 
+// If va lies in a megapage, replace the megapage's leaf PTE
+// with a page-table page of 512 ordinary PTEs that map the
+// same physical memory with the same permissions, so that
+// part of it can be unmapped, copied or protected.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmsplit(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t l0;
+  uint64 pa;
+  int level;
+
+  if((pte = walkleaf(pagetable, va, &level)) == 0 || level == 0)
+    return 0;
+  if(level != 1)
+    panic("uvmsplit");
+  if((l0 = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  for(int i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  *pte = PA2PTE(l0) | PTE_V;
+  // the TLB may still hold the 2 MiB translation; flushing
+  // any address in the megapage removes it.
+  tlbflush(pagetable, va - va % MEGAPGSIZE);
+  return 0;
+}
+
+// Map a zeroed megapage at va with permissions perm, if va
+// is megapage-aligned, nothing is mapped in the 2 MiB
+// region yet, and a free 2 MiB block is available.
+// Returns 0 if it did, -1 otherwise.
+static int
+uvmmega(pagetable_t pagetable, uint64 va, int perm)
+{
+  pte_t *pte;
+  char *mem;
+
+  if(va % MEGAPGSIZE != 0)
+    return -1;
+  if((pte = walklevel(pagetable, va, 1, 1)) == 0 || *pte != 0)
+    return -1;
+  if((mem = kalloc_order(MEGAPGORDER)) == 0)
+    return -1;
+  memset(mem, 0, MEGAPGSIZE);
+  *pte = PA2PTE(mem) | perm | PTE_V;
+  tlbflush(pagetable, va);
+  return 0;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages that were never mapped are skipped.
+// A megapage that is only partly in the range is split.
+// Optionally free the physical memory, a batch at a time.
+// Page-table pages that no longer map anything are freed.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end, stop;
+  pagetable_t dead = 0, next;
+  void *freed[32];
+  int level, nfreed = 0;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
-      panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+  end = va + npages*PGSIZE;
+  // skips whatever was never touched; see vmfault().
+  for(a = va; (pte = walkrange(pagetable, &a, end, &level)) != 0; ){
+    if(level > 0){
+      if(a % MEGAPGSIZE == 0 && end - a >= MEGAPGSIZE){
+        if(do_free)
+          kfree_order((void*)PTE2PA(*pte), MEGAPGORDER);
+        *pte = 0;
+        tlbflush(pagetable, a);
+        ptprune(pagetable, a, &dead);
+        a += MEGAPGSIZE;
+        continue;
+      }
+      if(uvmsplit(pagetable, a) < 0)
+        panic("uvmunmap: split");
+      continue;
+    }
+
+    // the rest of this page-table page.
+    stop = (a + MEGAPGSIZE) & ~(MEGAPGSIZE - 1);
+    if(stop > end)
+      stop = end;
+    for(; a < stop; a += PGSIZE, pte++){
+      if(*pte & PTE_SWAP){
+        // the page table owns an evicted page either way.
+        swapfree(PTE2SLOT(*pte));
+        *pte = 0;
+        continue;
+      }
+      if((*pte & PTE_V) == 0)
+        continue;
+      if(PTE_FLAGS(*pte) == PTE_V)
+        panic("uvmunmap: not a leaf");
+      if(do_free){
+        freed[nfreed++] = (void*)PTE2PA(*pte);
+        if(nfreed == NELEM(freed)){
+          kfreemany(freed, nfreed);
+          nfreed = 0;
+        }
+      }
+      *pte = 0;
+      tlbflush(pagetable, a);
+    }
+    ptprune(pagetable, a - PGSIZE, &dead);
+  }
+  if(nfreed > 0)
+    kfreemany(freed, nfreed);
+
+  if(dead){
+    tlbflushall(pagetable);
+    for(; dead; dead = next){
+      next = *(pagetable_t*)dead;
+      kfree(dead);
     }
-    *pte = 0;
   }
 }
 
@@ -197,10 +692,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -221,7 +715,8 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
-// newsz, which need not be page aligned.  Returns new size or 0 on error.
+// newsz, which need not be page aligned. Aligned 2 MiB stretches
+// get a megapage when one is free. Returns new size or 0 on error.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
@@ -233,12 +728,15 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if(newsz - a >= MEGAPGSIZE && uvmmega(pagetable, a, PTE_R|PTE_U|xperm) == 0){
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -296,53 +794,280 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, copy the part of
+// its memory in [start, end) into a child's page table.
+// Pages are not copied: the child maps the same physical
+// pages, and writable pages are marked read-only and
+// copy-on-write in both page tables; uvmcow() makes the
+// private copy on the first write. Evicted pages share
+// their swap slot.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 start, uint64 end)
 {
-  pte_t *pte;
-  uint64 pa, i;
-  uint flags;
-  char *mem;
+  pte_t *pte, *npte;
+  pagetable_t nl0;
+  uint64 pa, i, stop;
+  int level;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+  end = PGROUNDUP(end);
+  // skips whatever was never touched; see vmfault().
+  for(i = start; (pte = walkrange(old, &i, end, &level)) != 0; ){
+    if(level > 0){
+      if(i % MEGAPGSIZE != 0 || end - i < MEGAPGSIZE){
+        // only part of the megapage is to be copied.
+        if(uvmsplit(old, i) < 0)
+          goto err;
+        continue;
+      }
+      if(*pte & PTE_W){
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+        tlbflush(old, i);
+      }
+      // share the whole megapage; a write splits it.
+      if((npte = walklevel(new, i, 1, 1)) == 0)
+        goto err;
+      if(*npte & PTE_V)
+        panic("uvmcopy: remap");
+      pa = PTE2PA(*pte);
+      *npte = *pte;
+      for(int j = 0; j < 512; j++)
+        kref((void*)(pa + j*PGSIZE));
+      i += MEGAPGSIZE;
+      continue;
+    }
+
+    // the rest of this page-table page, into the child's
+    // corresponding page-table page, made when first needed.
+    stop = (i + MEGAPGSIZE) & ~(MEGAPGSIZE - 1);
+    if(stop > end)
+      stop = end;
+    nl0 = 0;
+    for(; i < stop; i += PGSIZE, pte++){
+      if((*pte & (PTE_V|PTE_SWAP)) == 0)
+        continue;
+      if(nl0 == 0){
+        if((npte = walk(new, i, 1)) == 0)
+          goto err;
+        nl0 = npte - PX(0, i);
+      }
+      npte = &nl0[PX(0, i)];
+      if(*npte != 0)
+        panic("uvmcopy: remap");
+      if(*pte & PTE_SWAP){
+        // share the slot; each reads its own copy back.
+        *npte = *pte;
+        swapdup(PTE2SLOT(*pte));
+        continue;
+      }
+      if(*pte & PTE_W){
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+        tlbflush(old, i);
+      }
+      *npte = *pte;
+      kref((void*)PTE2PA(*pte));
     }
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
+// Return pte with its permissions changed to perm, a
+// combination of PTE_R, PTE_W and PTE_X. Unless the page
+// belongs to a shared mapping, a page that is shared with
+// others becomes copy-on-write rather than writable.
+// perm 0 leaves the page mapped but inaccessible: PTE_X
+// alone keeps the PTE a leaf, and without PTE_U or PTE_R
+// neither the user nor the kernel can load from it (the
+// kernel never sets sstatus.MXR), even through the window.
+static pte_t
+pteprotect(pte_t pte, int perm, int shared)
+{
+  uint64 flags;
+
+  flags = PTE_FLAGS(pte) & ~(PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW);
+  if(perm == 0)
+    return PA2PTE(PTE2PA(pte)) | flags | PTE_X;
+  if(perm & PTE_W){
+    if(!shared && krefcount((void*)PTE2PA(pte)) > 1)
+      flags |= PTE_COW;
+    else
+      flags |= PTE_W;
+  }
+  return PA2PTE(PTE2PA(pte)) | flags | (perm & (PTE_R|PTE_X)) | PTE_U;
+}
+
+// Change the permissions of whatever pages are mapped
+// among the npages starting at va to perm; see pteprotect().
+// Returns 0 on success, -1 if out of memory.
+int
+uvmprotect(pagetable_t pagetable, uint64 va, uint64 npages, int perm, int shared)
+{
+  uint64 a, end;
+  pte_t *pte;
+  int level;
+
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += PGSIZE){
+    if((pte = walkleaf(pagetable, a, &level)) == 0)
+      continue;
+    if(*pte & PTE_SWAP){
+      // no one else maps an evicted page.
+      *pte = pteprotect(*pte, perm, 1);
+      continue;
+    }
+    if((*pte & PTE_V) == 0)
+      continue;
+    if(level > 0){
+      if(a % MEGAPGSIZE == 0 && end - a >= MEGAPGSIZE){
+        *pte = pteprotect(*pte, perm, shared);
+        tlbflush(pagetable, a);
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if(uvmsplit(pagetable, a) < 0)
+        return -1;
+      pte = walk(pagetable, a, 0);
+    }
+    *pte = pteprotect(*pte, perm, shared);
+    tlbflush(pagetable, a);
+  }
+  return 0;
+}
+
+// Resolve a write to the copy-on-write page at va:
+// give the page table a private, writable copy of
+// the page, or just make the page writable if no one
+// else refers to it any more.
+// Returns 0 on success, -1 if va is not a copy-on-write
+// page or memory is exhausted.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if(uvmsplit(pagetable, va) < 0)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcount((void*)pa) == 1){
+    // the other sharers have gone; keep the page.
+    *pte = PA2PTE(pa) | flags;
+    tlbflush(pagetable, va);
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  tlbflush(pagetable, va);
+  kfree((void*)pa);
+  return 0;
+}
+
+// Handle a page fault by the current process at user
+// virtual address va, or a kernel access on its behalf
+// from copyin()/copyout(). A page of a region (see vma.c)
+// that has not been touched yet is allocated, read in from
+// the region's file, or found in its shared memory
+// segment. A page below p->sz that has not been touched
+// since sbrk() reserved it is allocated too. A write to a
+// copy-on-write page gets a private copy, and an evicted
+// page is read back from swap (see swap.c).
+// May sleep, so the caller must not hold a spinlock.
+// Returns 0 if the access can now proceed, -1 if it is
+// invalid or memory is exhausted.
+int
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  pte_t *pte;
+  uint64 base, lo, hi;
+  int perm;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  swapreclaim();
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & PTE_COW))
+      return uvmcow(pagetable, va);
+    return -1;
+  }
+  if(pte && (*pte & PTE_SWAP))
+    return swapin(pagetable, va, pte);
+
+  if(p == 0 || pagetable != p->pagetable)
+    return -1;
+
+  if((v = vmafind(p, va, va + PGSIZE)) != 0){
+    if((v->perm & (write ? PTE_W : PTE_R|PTE_X)) == 0)
+      return -1;
+    if(v->type != VMA_ANON)
+      return vmafill(pagetable, v, va);
+    lo = v->start;
+    hi = v->end;
+    perm = v->perm;
+  } else if(va < p->sz){
+    lo = 0;
+    hi = p->sz;
+    perm = PTE_R|PTE_W;
+  } else {
+    return -1;
+  }
+
+  // the first touch of an untouched, aligned 2 MiB stretch
+  // of heap or anonymous region maps a whole megapage.
+  base = va & ~(MEGAPGSIZE - 1);
+  if(base >= lo && base + MEGAPGSIZE <= hi &&
+     (v != 0 || vmafind(p, base, base + MEGAPGSIZE) == 0) &&
+     uvmmega(pagetable, base, perm|PTE_U) == 0)
+    return 0;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
+// like a PROT_NONE page (see pteprotect()), the kernel
+// cannot read or write it through the window either.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   
+  if(uvmsplit(pagetable, va) < 0)
+    panic("uvmclear: split");
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  *pte = (*pte & ~(PTE_U|PTE_R|PTE_W)) | PTE_X;
+  tlbflush(pagetable, va);
 }
 
 // Copy from kernel to user.
@@ -352,12 +1077,30 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+  int level;
+
+  if(uwinok(pagetable, dstva, len)){
+    if(copy_user((void*)UWIN(dstva), src, len) == 0)
+      return 0;
+    // a page that is not there, copy-on-write, or read-only;
+    // do it a page at a time, faulting pages in.
+    uwinsync(pagetable);
+  }
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
+      return -1;
+    pte = walkleaf(pagetable, va0, &level);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW)){
+      if(vmfault(pagetable, va0, 1) < 0)
+        return -1;
+      pte = walkleaf(pagetable, va0, &level);
+    }
+    if((*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
       return -1;
+    pa0 = PTE2PA(*pte) + (va0 & (LEVELSIZE(level) - 1));
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -378,11 +1121,20 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(uwinok(pagetable, srcva, len)){
+    if(copy_user(dst, (void*)UWIN(srcva), len) == 0)
+      return 0;
+    uwinsync(pagetable);
+  }
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) < 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -405,11 +1157,24 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(uwinok(pagetable, srcva, max)){
+    switch(copyinstr_user(dst, (char*)UWIN(srcva), max)){
+    case 0:
+      return 0;
+    case 1:
+      return -1;
+    }
+    uwinsync(pagetable);
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(pa0 == 0){
+      if(vmfault(pagetable, va0, 0) < 0)
+        return -1;
+      pa0 = walkaddr(pagetable, va0);
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
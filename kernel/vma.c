@@ -0,0 +1,592 @@
+// Virtual memory areas.
+//
+// Besides the [0, p->sz) range that exec() and sbrk() manage,
+// a process's address space holds up to NVMA regions, each
+// described by a struct vma in p->vma[]: the segments of the
+// program, which exec() sets up, and the regions mapped by
+// mmap(), which are placed downward from MMAPTOP. vmfault()
+// allocates or reads in the pages of a region when they are
+// first touched.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "mman.h"
+
+// Return the first of p's regions that overlaps
+// [start, end), or 0 if there is none.
+struct vma *
+vmafind(struct proc *p, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->type != VMA_NONE && v->start < end && start < v->end)
+      return v;
+  }
+  return 0;
+}
+
+static struct vma *
+vmaalloc(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->type == VMA_NONE)
+      return v;
+  }
+  return 0;
+}
+
+// Take another reference to what region v maps, for a
+// copy of v.
+static void
+vmadup(struct vma *v)
+{
+  if(v->type == VMA_FILE){
+    idup(v->ip);
+    if(v->flags & MAP_SHARED)
+      __sync_fetch_and_add(&v->ip->nshared, 1);
+  } else if(v->type == VMA_SHM)
+    shmdup(v->shmid);
+}
+
+// Mark v unused, dropping its reference to what it maps.
+// The page cache keeps a file's shared pages as long as any
+// region maps the file, so that every mapper sees the same
+// pages, however many there are; the last region to go
+// drops them.
+static void
+vmadrop(struct vma *v)
+{
+  if(v->type == VMA_FILE){
+    if(v->flags & MAP_SHARED){
+      ilock(v->ip);
+      if(__sync_sub_and_fetch(&v->ip->nshared, 1) == 0)
+        textinval(v->ip->dev, v->ip->inum, 1);
+      iunlock(v->ip);
+    }
+    begin_op();
+    iput(v->ip);
+    end_op();
+  } else if(v->type == VMA_SHM){
+    shmput(v->shmid);
+  }
+  memset(v, 0, sizeof(*v));
+}
+
+// Split v in two at a, if a falls strictly inside it,
+// so that v ends at a and a new region starts there.
+// Returns 0 on success, -1 if p has no free region.
+static int
+vmasplit(struct proc *p, struct vma *v, uint64 a)
+{
+  struct vma *nv;
+  uint64 d;
+
+  if(a <= v->start || a >= v->end)
+    return 0;
+  if((nv = vmaalloc(p)) == 0)
+    return -1;
+  d = a - v->start;
+  *nv = *v;
+  nv->start = a;
+  nv->off += d;
+  nv->filesz = v->filesz > d ? v->filesz - d : 0;
+  vmadup(nv);
+  v->end = a;
+  if(v->filesz > d)
+    v->filesz = d;
+  return 0;
+}
+
+// Read the page at va of file region v in from its file,
+// zeroing whatever lies beyond the file data, and map it.
+// Pages of shared regions, and of read-only private ones,
+// come from and go into the page cache in textcache.c.
+// The caller must hold v->ip's lock.
+// Returns 0 on success, -1 on failure.
+static int
+vmareadpage(pagetable_t pagetable, struct vma *v, uint64 va)
+{
+  struct inode *ip = v->ip;
+  uint off = v->off + (va - v->start);
+  uint n = 0;
+  int shared = (v->flags & MAP_SHARED) != 0;
+  int cached = shared || (v->perm & PTE_W) == 0;
+  char *mem;
+
+  if(shared){
+    // a shared page holds as much of the file as there is.
+    if(off < ip->size)
+      n = ip->size - off;
+  } else if(va - v->start < v->filesz){
+    n = v->filesz - (va - v->start);
+  }
+  if(n > PGSIZE)
+    n = PGSIZE;
+
+  if(cached && (mem = textget(ip->dev, ip->inum, off, n, shared)) != 0)
+    goto map;
+  if((mem = kalloc()) == 0)
+    return -1;
+  if(n > 0 && readi(ip, 0, (uint64)mem, off, n) != n)
+    goto bad;
+  memset(mem + n, 0, PGSIZE - n);
+  if(cached && textput(ip->dev, ip->inum, off, n, shared, mem) < 0 && shared)
+    goto bad; // other mappings could not see it.
+
+ map:
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, v->perm|PTE_U) != 0)
+    goto bad;
+  return 0;
+
+ bad:
+  kfree(mem);
+  return -1;
+}
+
+// Map the page at va of shared memory region v.
+// Returns 0 on success, -1 on failure.
+static int
+vmashmpage(pagetable_t pagetable, struct vma *v, uint64 va)
+{
+  void *pa;
+
+  if((pa = shmpage(v->shmid, (v->off + (va - v->start)) / PGSIZE)) == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)pa, v->perm|PTE_U) != 0){
+    kfree(pa);
+    return -1;
+  }
+  return 0;
+}
+
+// Map the page at va of file or shared memory region v.
+// For a file region, read it in, then any other untouched
+// pages of file data in the same aligned window of
+// FAULTAROUND pages, which the program is likely to need
+// soon; a failure on those is not an error.
+// Returns 0 on success, -1 on failure.
+int
+vmafill(pagetable_t pagetable, struct vma *v, uint64 va)
+{
+  uint64 a, lo, hi;
+  pte_t *pte;
+  int r;
+
+  if(v->type == VMA_SHM)
+    return vmashmpage(pagetable, v, va);
+
+  lo = va - va % (FAULTAROUND*PGSIZE);
+  hi = lo + FAULTAROUND*PGSIZE;
+  if(lo < v->start)
+    lo = v->start;
+  if(hi > v->end)
+    hi = v->end;
+
+  // reading the page in while a read() or write() of the
+  // same file holds its lock could need the very buffer
+  // that the copy holds locked. vmaprefault() faults such
+  // pages in beforehand; if one has gone again, fail the
+  // copy rather than deadlock.
+  if(holdingsleep(&v->ip->lock))
+    return -1;
+  ilock(v->ip);
+  r = vmareadpage(pagetable, v, va);
+  for(a = lo; r == 0 && a < hi && a - v->start < v->filesz; a += PGSIZE){
+    if(a == va)
+      continue;
+    pte = walk(pagetable, a, 0);
+    if(pte && (*pte & (PTE_V|PTE_SWAP)))
+      continue;
+    if(vmareadpage(pagetable, v, a) < 0)
+      break;
+  }
+  iunlock(v->ip);
+  return r;
+}
+
+// Fault in the current process's pages of file regions in
+// [addr, addr+n), for writing if write is set. fileread()
+// and filewrite() call this before they lock the file's
+// inode, since vmafill() cannot read a page in while the
+// copy to or from user memory holds that lock (and perhaps
+// a buffer of the mapped file). Errors are left for the
+// copy to find.
+void
+vmaprefault(uint64 addr, uint64 n, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a;
+  pte_t *pte;
+
+  if(addr + n < addr)
+    return;
+  for(a = PGROUNDDOWN(addr); a < addr + n; a += PGSIZE){
+    if((v = vmafind(p, a, a + PGSIZE)) == 0 || v->type != VMA_FILE)
+      continue;
+    pte = walk(p->pagetable, a, 0);
+    if(pte && (*pte & PTE_V) && (!write || (*pte & PTE_W)))
+      continue;
+    vmfault(p->pagetable, a, write);
+  }
+}
+
+// Write the pages of shared file region v in [start, end)
+// that pagetable maps dirty back to the file, through the
+// log. Does not grow the file.
+static void
+vmasync(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint64 a, pa;
+  uint off, i, n;
+  pte_t *pte;
+
+  for(a = start; a < end; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_D)) != (PTE_V|PTE_D))
+      continue;
+    // a write through a stale TLB entry would not set
+    // PTE_D again.
+    *pte &= ~PTE_D;
+    tlbflush(pagetable, a);
+    pa = PTE2PA(*pte);
+    off = v->off + (a - v->start);
+    // write a few blocks at a time, as filewrite() does,
+    // to avoid exceeding the maximum log transaction size.
+    for(i = 0; i < PGSIZE; i += n){
+      n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      begin_op();
+      ilock(v->ip);
+      if(off + i >= v->ip->size){
+        n = PGSIZE - i;
+      } else {
+        if(n > v->ip->size - (off + i))
+          n = v->ip->size - (off + i);
+        writei(v->ip, 0, pa + i, off + i, n);
+      }
+      iunlock(v->ip);
+      end_op();
+    }
+  }
+}
+
+// Give child np the parent p's regions, sharing the pages
+// that lie above p->sz, which uvmcopy() of [0, p->sz) does
+// not cover. The child of a shared region finds the same
+// pages in the page cache or segment when it faults them in.
+// Returns 0 on success, -1 on failure, having unmapped
+// whatever it mapped in np.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  uint64 lo;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    lo = PGROUNDUP(p->sz);
+    if(v->type == VMA_NONE || v->end <= lo || (v->flags & MAP_SHARED))
+      continue;
+    if(v->start > lo)
+      lo = v->start;
+    if(uvmcopy(p->pagetable, np->pagetable, lo, v->end) < 0)
+      goto err;
+  }
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    vmadup(&np->vma[i]);
+  }
+  return 0;
+
+ err:
+  while(--i >= 0){
+    v = &p->vma[i];
+    lo = PGROUNDUP(p->sz);
+    if(v->type == VMA_NONE || v->end <= lo || (v->flags & MAP_SHARED))
+      continue;
+    if(v->start > lo)
+      lo = v->start;
+    uvmunmap(np->pagetable, lo, (v->end - lo) / PGSIZE, 1);
+  }
+  return -1;
+}
+
+// Write back what pagetable, if it is not 0, dirtied of an
+// array of NVMA shared file regions, unmap the regions'
+// pages from it if unmap is set, and mark the regions
+// unused. Used by exit(), which leaves unmapping to the
+// reaper, and exec().
+void
+vmafree(pagetable_t pagetable, struct vma *vma, int unmap)
+{
+  struct vma *v;
+
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->type == VMA_NONE)
+      continue;
+    if(pagetable){
+      if(v->type == VMA_FILE && (v->flags & MAP_SHARED))
+        vmasync(pagetable, v, v->start, v->end);
+      if(unmap)
+        uvmunmap(pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+    }
+    vmadrop(v);
+  }
+}
+
+static int
+prot2perm(int prot)
+{
+  int perm = 0;
+
+  if(prot & PROT_READ)
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Find a free stretch of len bytes for a new region: at
+// addr if that is free, otherwise as high as possible below
+// MMAPTOP and above the heap.
+// Returns its address, or 0 if there is none.
+static uint64
+vmaplace(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v;
+  uint64 end;
+
+  if(addr % PGSIZE == 0 && addr >= PGROUNDUP(p->sz) && addr <= MMAPTOP - len &&
+     vmafind(p, addr, addr + len) == 0)
+    return addr;
+
+  for(end = MMAPTOP; end >= len && end - len >= PGROUNDUP(p->sz); end = v->start){
+    if((v = vmafind(p, end - len, end)) == 0)
+      return end - len;
+  }
+  return 0;
+}
+
+// Map len bytes at offset off of file f, or of zero-filled
+// memory if flags has MAP_ANONYMOUS, with protection prot;
+// at addr if that range is free and otherwise wherever
+// there is room. Changes to a MAP_SHARED mapping reach the
+// file on msync(), munmap() and exit; a MAP_PRIVATE mapping
+// is copy-on-write.
+// Returns the address, or -1 on failure.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  int perm, share;
+
+  share = flags & (MAP_SHARED|MAP_PRIVATE);
+  if(len == 0 || len > MMAPTOP || (share != MAP_SHARED && share != MAP_PRIVATE))
+    return -1;
+  if(flags & ~(MAP_SHARED|MAP_PRIVATE|MAP_ANONYMOUS))
+    return -1;
+  if(flags & MAP_ANONYMOUS){
+    if(share != MAP_PRIVATE)
+      return -1;
+    f = 0;
+  } else {
+    if(f == 0 || f->type != FD_INODE || !f->readable || off % PGSIZE != 0)
+      return -1;
+    if(share == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  len = PGROUNDUP(len);
+  perm = prot2perm(prot);
+
+  if((addr = vmaplace(p, addr, len)) == 0)
+    return -1;
+
+  // grow a neighbouring anonymous region with the same
+  // protection rather than use up another one.
+  for(v = p->vma; f == 0 && v < &p->vma[NVMA]; v++){
+    if(v->type != VMA_ANON || v->perm != perm)
+      continue;
+    if(v->end == addr){
+      v->end = addr + len;
+      return addr;
+    }
+    if(v->start == addr + len){
+      v->start = addr;
+      return addr;
+    }
+  }
+
+  if((v = vmaalloc(p)) == 0)
+    return -1;
+  v->type = f ? VMA_FILE : VMA_ANON;
+  v->start = addr;
+  v->end = addr + len;
+  v->perm = perm;
+  v->flags = share;
+  // writes to a shared mapping reach the file.
+  v->rdonly = share == MAP_SHARED && f && !f->writable;
+  if(f){
+    v->ip = idup(f->ip);
+    v->off = off;
+    ilock(v->ip);
+    v->filesz = v->ip->size > off ? v->ip->size - off : 0;
+    if(share == MAP_SHARED)
+      __sync_fetch_and_add(&v->ip->nshared, 1);
+    iunlock(v->ip);
+    if(v->filesz > len)
+      v->filesz = len;
+  }
+  return addr;
+}
+
+// Remove the mappings of the pages in [addr, addr+len),
+// freeing their memory. addr must be page-aligned.
+// Returns 0 on success, -1 on failure.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 end;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr || addr + len > MAXVA)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  while((v = vmafind(p, addr, end)) != 0){
+    if(v->start < addr){
+      if(vmasplit(p, v, addr) < 0)
+        return -1;
+      continue;
+    }
+    if(vmasplit(p, v, end) < 0)
+      return -1;
+    if(v->type == VMA_FILE && (v->flags & MAP_SHARED))
+      vmasync(p->pagetable, v, v->start, v->end);
+    uvmunmap(p->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+    vmadrop(v);
+  }
+  return 0;
+}
+
+// Write back the changes made through shared file mappings
+// to the pages in [addr, addr+len).
+// Returns 0 on success, -1 on failure.
+int
+msync(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 end;
+
+  if(addr % PGSIZE != 0 || addr + len < addr || addr + len > MAXVA)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->type != VMA_FILE || (v->flags & MAP_SHARED) == 0)
+      continue;
+    if(v->end <= addr || end <= v->start)
+      continue;
+    vmasync(p->pagetable, v, addr > v->start ? addr : v->start,
+            end < v->end ? end : v->end);
+  }
+  return 0;
+}
+
+// Change the protection of the pages in [addr, addr+len),
+// which must all lie in mapped regions, to prot. A region
+// that mmap() would not have let be writable cannot be made
+// so.
+// Returns 0 on success, -1 on failure.
+int
+mprotect(uint64 addr, uint64 len, int prot)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, end;
+  int perm;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr || addr + len > MAXVA)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  perm = prot2perm(prot);
+
+  for(a = addr; a < end; a = v->end){
+    if((v = vmafind(p, a, a + PGSIZE)) == 0)
+      return -1;
+    if((perm & PTE_W) && v->rdonly)
+      return -1;
+  }
+
+  for(a = addr; a < end; a = v->end){
+    v = vmafind(p, a, a + PGSIZE);
+    if(vmasplit(p, v, a) < 0)
+      return -1;
+    v = vmafind(p, a, a + PGSIZE);
+    if(vmasplit(p, v, end) < 0)
+      return -1;
+    v->perm = perm;
+    if(uvmprotect(p->pagetable, v->start, (v->end - v->start) / PGSIZE, perm,
+                  v->flags & MAP_SHARED) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Attach shared memory segment id at addr, or wherever there
+// is room if addr is 0 or not free; read-only if flags has
+// SHM_RDONLY.
+// Returns the address, or -1 on failure.
+uint64
+shmat(int id, uint64 addr, int flags)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 len;
+
+  if((len = shmattach(id)) == 0)
+    return -1;
+  if((addr = vmaplace(p, addr, len)) == 0 || (v = vmaalloc(p)) == 0){
+    shmput(id);
+    return -1;
+  }
+  v->type = VMA_SHM;
+  v->start = addr;
+  v->end = addr + len;
+  v->perm = (flags & SHM_RDONLY) ? PTE_R : PTE_R|PTE_W;
+  v->rdonly = (flags & SHM_RDONLY) != 0;
+  v->flags = MAP_SHARED;
+  v->shmid = id;
+  return addr;
+}
+
+// Detach the shared memory segment attached at addr.
+// Returns 0 on success, -1 on failure.
+int
+shmdt(uint64 addr)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if((v = vmafind(p, addr, addr + 1)) == 0 || v->type != VMA_SHM || v->start != addr)
+    return -1;
+  return munmap(v->start, v->end - v->start);
+}
@@ -0,0 +1,334 @@
+// Compressed swap in memory.
+//
+// swap.c first offers each page it evicts to zstore(),
+// which compresses it with a small LZ77 compressor into a
+// pool of pages taken from kalloc(), so that a fault costs
+// a decompression rather than a disk read. A page that does
+// not compress to ZMAXLEN bytes, or that does not fit in a
+// pool of NZRAM pages, goes to the swap disk instead.
+//
+// Each pool page is divided into ZCHUNK-byte chunks, and a
+// compressed page takes a run of whole chunks within one
+// pool page. A pool page returns to kalloc() when the last
+// compressed page in it is freed.
+//
+// The compressed format is a series of sequences, each a
+// token byte, its literal bytes, and a match: the token's
+// high nibble is the number of literals and its low nibble
+// the match length less ZMINMATCH; a nibble of 15 is
+// followed by bytes to add to it, up to one that is not
+// 255. The literals are followed by the match's 2-byte
+// offset back into the output. The last sequence has
+// literals only.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define ZCHUNK     128                      // bytes per pool chunk
+#define ZNCHUNK    (PGSIZE / ZCHUNK)        // chunks per pool page: 32
+#define ZMAXLEN    (PGSIZE * 3 / 4)         // compress at least this well
+#define NZSLOT     (4 * NZRAM)              // most compressed pages
+#define ZMINMATCH  4
+#define ZHASHBITS  10
+
+struct zslot {
+  uint64 pa;     // start of the compressed data; 0 if the slot is free
+  ushort len;    // bytes of compressed data
+  uchar ref;     // PTEs that refer to the slot
+};
+
+struct {
+  struct spinlock lock;
+  struct zslot slot[NZSLOT];
+  struct {
+    uint64 pa;   // the pool page; 0 if none
+    uint32 map;  // chunks in use
+  } page[NZRAM];
+  uint npage;    // pool pages allocated
+  uint nstored;  // compressed pages
+  uint64 nbytes; // bytes of compressed data
+  uint nstore;   // statistics, for zramdump()
+  uint nreject;
+  uint nfault;
+} zram;
+
+// for zcompress(); only swap.c's evictor uses them, one at a time.
+static ushort zhash[1 << ZHASHBITS];
+static uchar zbuf[ZMAXLEN];
+
+void
+zraminit(void)
+{
+  initlock(&zram.lock, "zram");
+}
+
+static uint32
+read32(uchar *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32)p[3] << 24;
+}
+
+// Append length n, less the part that went in a token
+// nibble, at op. Returns the new op, or 0 if past oend.
+static uchar*
+putlen(uchar *op, uchar *oend, int n)
+{
+  for(; n >= 255; n -= 255){
+    if(op >= oend)
+      return 0;
+    *op++ = 255;
+  }
+  if(op >= oend)
+    return 0;
+  *op++ = n;
+  return op;
+}
+
+// Append a sequence of n literals at lit followed by a
+// match of mlen bytes at offset off (none if mlen is 0).
+// Returns the new op, or 0 if past oend.
+static uchar*
+putseq(uchar *op, uchar *oend, uchar *lit, int n, int off, int mlen)
+{
+  uchar *token;
+
+  if(op >= oend)
+    return 0;
+  token = op++;
+  *token = (n < 15 ? n : 15) << 4;
+  if(n >= 15 && (op = putlen(op, oend, n - 15)) == 0)
+    return 0;
+  if(op + n > oend)
+    return 0;
+  memmove(op, lit, n);
+  op += n;
+  if(mlen == 0)
+    return op;
+  if(op + 2 > oend)
+    return 0;
+  *op++ = off;
+  *op++ = off >> 8;
+  mlen -= ZMINMATCH;
+  *token |= mlen < 15 ? mlen : 15;
+  if(mlen >= 15 && (op = putlen(op, oend, mlen - 15)) == 0)
+    return 0;
+  return op;
+}
+
+// Compress the page src into dst, which has room for max
+// bytes. Returns the compressed length, or -1 if it does
+// not fit.
+static int
+zcompress(uchar *src, uchar *dst, int max)
+{
+  uchar *op = dst, *oend = dst + max;
+  int i, anchor, ref, mlen;
+  uint32 v, h;
+
+  memset(zhash, 0, sizeof(zhash));
+  anchor = 0;
+  for(i = 0; i + ZMINMATCH <= PGSIZE; ){
+    v = read32(src + i);
+    h = (v * 2654435761U) >> (32 - ZHASHBITS);
+    ref = zhash[h];
+    zhash[h] = i;
+    if(ref >= i || read32(src + ref) != v){
+      i++;
+      continue;
+    }
+    for(mlen = ZMINMATCH; i + mlen < PGSIZE && src[ref + mlen] == src[i + mlen]; mlen++)
+      ;
+    if((op = putseq(op, oend, src + anchor, i - anchor, i - ref, mlen)) == 0)
+      return -1;
+    i += mlen;
+    anchor = i;
+  }
+  if((op = putseq(op, oend, src + anchor, PGSIZE - anchor, 0, 0)) == 0)
+    return -1;
+  return op - dst;
+}
+
+// Read a length continued past a token nibble of 15.
+static int
+getlen(uchar **ipp, int n)
+{
+  uchar b;
+
+  do {
+    b = *(*ipp)++;
+    n += b;
+  } while(b == 255);
+  return n;
+}
+
+// Decompress the len bytes at src into the page dst.
+static void
+zdecompress(uchar *src, int len, uchar *dst)
+{
+  uchar *ip = src, *iend = src + len, *op = dst, *m;
+  int token, n;
+
+  while(ip < iend){
+    token = *ip++;
+    if((n = token >> 4) == 15)
+      n = getlen(&ip, n);
+    memmove(op, ip, n);
+    op += n;
+    ip += n;
+    if(ip >= iend)
+      break;
+    m = op - (ip[0] | ip[1] << 8);
+    ip += 2;
+    if((n = token & 15) == 15)
+      n = getlen(&ip, n);
+    // the match may overlap its own output.
+    for(n += ZMINMATCH; n > 0; n--)
+      *op++ = *m++;
+  }
+  if(op != dst + PGSIZE)
+    panic("zdecompress");
+}
+
+// Find a run of n free chunks in a pool page, taking a new
+// pool page if need be, and mark it used. Returns its
+// address, or 0 if the pool is full.
+// Caller must hold zram.lock.
+static uint64
+zchunks(int n)
+{
+  uint32 want = n == 32 ? ~0U : ((1U << n) - 1);
+  int i, c, free = -1;
+
+  for(i = 0; i < NZRAM; i++){
+    if(zram.page[i].pa == 0){
+      if(free < 0)
+        free = i;
+      continue;
+    }
+    for(c = 0; c + n <= ZNCHUNK; c++){
+      if((zram.page[i].map & (want << c)) == 0){
+        zram.page[i].map |= want << c;
+        return zram.page[i].pa + c * ZCHUNK;
+      }
+    }
+  }
+  if(free < 0 || (zram.page[free].pa = (uint64)kalloc()) == 0)
+    return 0;
+  zram.npage++;
+  zram.page[free].map = want;
+  return zram.page[free].pa;
+}
+
+// Free the n chunks at pa, and the pool page that held them
+// if it is now empty. Caller must hold zram.lock.
+static void
+zunchunks(uint64 pa, int n)
+{
+  uint32 want = n == 32 ? ~0U : ((1U << n) - 1);
+
+  for(int i = 0; i < NZRAM; i++){
+    if(zram.page[i].pa == PGROUNDDOWN(pa)){
+      zram.page[i].map &= ~(want << ((pa % PGSIZE) / ZCHUNK));
+      if(zram.page[i].map == 0){
+        kfree((void*)zram.page[i].pa);
+        zram.page[i].pa = 0;
+        zram.npage--;
+      }
+      return;
+    }
+  }
+  panic("zunchunks");
+}
+
+// Compress the page pa into the pool, for swap.c's
+// evictor. Returns the slot that holds it, or -1 if the
+// page does not compress well or there is no room.
+int
+zstore(void *pa)
+{
+  struct zslot *z;
+  uint64 dst;
+  int len;
+
+  if((len = zcompress(pa, zbuf, ZMAXLEN)) < 0){
+    __sync_fetch_and_add(&zram.nreject, 1);
+    return -1;
+  }
+
+  acquire(&zram.lock);
+  for(z = zram.slot; z < &zram.slot[NZSLOT]; z++)
+    if(z->pa == 0)
+      break;
+  if(z == &zram.slot[NZSLOT] || (dst = zchunks((len + ZCHUNK - 1) / ZCHUNK)) == 0){
+    release(&zram.lock);
+    return -1;
+  }
+  memmove((void*)dst, zbuf, len);
+  z->pa = dst;
+  z->len = len;
+  z->ref = 1;
+  zram.nstored++;
+  zram.nbytes += len;
+  zram.nstore++;
+  release(&zram.lock);
+  return z - zram.slot;
+}
+
+// Decompress slot i into the page pa.
+void
+zload(int i, void *pa)
+{
+  struct zslot *z = &zram.slot[i];
+
+  // the slot cannot be freed meanwhile: the caller's PTE
+  // refers to it.
+  if(i < 0 || i >= NZSLOT || z->pa == 0)
+    panic("zload");
+  zdecompress((uchar*)z->pa, z->len, pa);
+  __sync_fetch_and_add(&zram.nfault, 1);
+}
+
+// Another PTE refers to slot i, for fork().
+void
+zdup(int i)
+{
+  acquire(&zram.lock);
+  if(i < 0 || i >= NZSLOT || zram.slot[i].ref == 0)
+    panic("zdup");
+  zram.slot[i].ref++;
+  release(&zram.lock);
+}
+
+// A PTE that referred to slot i is gone.
+void
+zfree(int i)
+{
+  struct zslot *z = &zram.slot[i];
+
+  acquire(&zram.lock);
+  if(i < 0 || i >= NZSLOT || z->ref == 0)
+    panic("zfree");
+  if(--z->ref == 0){
+    zunchunks(z->pa, (z->len + ZCHUNK - 1) / ZCHUNK);
+    zram.nstored--;
+    zram.nbytes -= z->len;
+    z->pa = 0;
+  }
+  release(&zram.lock);
+}
+
+// Print compressed swap statistics; see kallocdump().
+void
+zramdump(void)
+{
+  uint ratio = 0;
+
+  if(zram.nbytes > 0)
+    ratio = (uint64)zram.nstored * PGSIZE * 10 / zram.nbytes;
+  printf("zram: %d pages in %d pool pages, compressed %d.%d:1, %d stored, %d rejected, %d faults\n",
+         zram.nstored, zram.npage, ratio / 10, ratio % 10,
+         zram.nstore, zram.nreject, zram.nfault);
+}
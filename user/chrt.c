@@ -0,0 +1,38 @@
+// chrt [-f|-r] prio cmd args...: run cmd at real-time
+// priority prio, from 1 to RTPRIOMAX, in class SCHED_RTFIFO
+// (-f) or SCHED_RTRR (-r, the default); prio 0 runs it in
+// SCHED_OTHER.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/sched.h"
+#include "user/user.h"
+
+int
+main(int argc, char **argv)
+{
+  int sclass = SCHED_RTRR, prio;
+
+  if(argc > 1 && strcmp(argv[1], "-f") == 0){
+    sclass = SCHED_RTFIFO;
+    argc--;
+    argv++;
+  } else if(argc > 1 && strcmp(argv[1], "-r") == 0){
+    argc--;
+    argv++;
+  }
+  if(argc < 3){
+    fprintf(2, "usage: chrt [-f|-r] prio cmd args...\n");
+    exit(1);
+  }
+  prio = atoi(argv[1]);
+  if(prio == 0)
+    sclass = SCHED_OTHER;
+  if(setscheduler(0, sclass, prio) < 0){
+    fprintf(2, "chrt: bad priority %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "chrt: exec %s failed\n", argv[2]);
+  exit(1);
+}
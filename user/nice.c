@@ -0,0 +1,27 @@
+// nice n cmd args...: run cmd at nice value n, from -20 to 19.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char **argv)
+{
+  int n;
+
+  if(argc < 3){
+    fprintf(2, "usage: nice n cmd args...\n");
+    exit(1);
+  }
+  if(argv[1][0] == '-')
+    n = -atoi(argv[1] + 1);
+  else
+    n = atoi(argv[1]);
+  if(setpriority(0, n) < 0){
+    fprintf(2, "nice: bad value %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "nice: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -52,6 +52,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 void runcmd(struct cmd*) __attribute__((noreturn));
 
 // Execute cmd.  Never returns.
@@ -131,6 +132,76 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Can cmd run with spawn() alone, without a forked shell?
+// True for pipelines of simple commands with redirections.
+int
+spawnable(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case EXEC:
+    return ((struct execcmd*)cmd)->argv[0] != 0;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    return spawnable(((struct pipecmd*)cmd)->left) &&
+           spawnable(((struct pipecmd*)cmd)->right);
+  }
+  return 0;
+}
+
+// Start a spawnable cmd with fd[0..2] as its standard
+// input, output and error, rather than forking a copy of
+// the shell to run it.  Returns the number of processes
+// started, for the caller to wait for.
+int
+spawncmd(struct cmd *cmd, int *fd)
+{
+  int p[2], nfd[3], n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  default:
+    panic("spawncmd");
+
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(spawn(ecmd->argv[0], ecmd->argv, fd, 3) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    memmove(nfd, fd, sizeof(nfd));
+    if((nfd[rcmd->fd] = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    n = spawncmd(rcmd->cmd, nfd);
+    close(nfd[rcmd->fd]);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0)
+      panic("pipe");
+    nfd[0] = fd[0];
+    nfd[1] = p[1];
+    nfd[2] = fd[2];
+    n = spawncmd(pcmd->left, nfd);
+    nfd[0] = p[0];
+    nfd[1] = fd[1];
+    n += spawncmd(pcmd->right, nfd);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -142,11 +213,14 @@ getcmd(char *buf, int nbuf)
   return 0;
 }
 
+struct cmd *parsed;
+
 int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, n;
+  int stdfd[3] = { 0, 1, 2 };
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -165,9 +239,26 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
+    // Parse in a vfork()ed child, which shares the shell's
+    // memory, so that a syntax error exits it and not the
+    // shell.
+    parsed = 0;
+    if(vfork() == 0){
+      parsed = parsecmd(buf);
+      exit(0);
+    }
     wait(0);
+    if(parsed == 0)
+      continue;
+    if(spawnable(parsed)){
+      for(n = spawncmd(parsed, stdfd); n > 0; n--)
+        wait(0);
+    } else {
+      if(fork1() == 0)
+        runcmd(parsed);
+      wait(0);
+    }
+    freecmd(parsed);
   }
   exit(0);
 }
@@ -492,3 +583,28 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+
+  case PIPE:
+  case LIST:
+    // pipecmd and listcmd have the same layout.
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,59 @@
+// taskset mask cmd args...: run cmd on the CPUs whose bits
+// are set in mask, a hexadecimal number.
+// taskset -p pid: print the CPUs process pid may run on.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// parse a hexadecimal mask, with or without 0x in front.
+// returns 0 if s is not one.
+uint64
+hexmask(char *s)
+{
+  uint64 m = 0;
+  int d;
+
+  if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    s += 2;
+  if(*s == 0)
+    return 0;
+  for(; *s; s++){
+    if(*s >= '0' && *s <= '9')
+      d = *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      d = *s - 'a' + 10;
+    else if(*s >= 'A' && *s <= 'F')
+      d = *s - 'A' + 10;
+    else
+      return 0;
+    m = (m << 4) | d;
+  }
+  return m;
+}
+
+int
+main(int argc, char **argv)
+{
+  uint64 mask;
+
+  if(argc == 3 && strcmp(argv[1], "-p") == 0){
+    if(getaffinity(atoi(argv[2]), &mask) < 0){
+      fprintf(2, "taskset: no process %s\n", argv[2]);
+      exit(1);
+    }
+    printf("pid %s: mask %x\n", argv[2], (int)mask);
+    exit(0);
+  }
+  if(argc < 3){
+    fprintf(2, "usage: taskset mask cmd args... | taskset -p pid\n");
+    exit(1);
+  }
+  if((mask = hexmask(argv[1])) == 0 || setaffinity(0, mask) < 0){
+    fprintf(2, "taskset: bad mask %s\n", argv[1]);
+    exit(1);
+  }
+  exec(argv[2], argv + 2);
+  fprintf(2, "taskset: exec %s failed\n", argv[2]);
+  exit(1);
+}
@@ -2,6 +2,7 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/mman.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
@@ -18,6 +19,12 @@ union header {
 
 typedef union header Header;
 
+// Blocks of MMAPBYTES or more come straight from mmap() and go
+// back to the kernel when freed; their header's ptr is MMAPPED
+// instead of a free-list link.
+#define MMAPBYTES (64*1024)
+#define MMAPPED ((Header*)1)
+
 static Header base;
 static Header *freep;
 
@@ -27,6 +34,10 @@ free(void *ap)
   Header *bp, *p;
 
   bp = (Header*)ap - 1;
+  if(bp->s.ptr == MMAPPED){
+    munmap(bp, bp->s.size * sizeof(Header));
+    return;
+  }
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -67,6 +78,15 @@ malloc(uint nbytes)
   uint nunits;
 
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nbytes >= MMAPBYTES){
+    p = mmap(0, nunits * sizeof(Header), PROT_READ|PROT_WRITE,
+             MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    if(p == MAP_FAILED)
+      return 0;
+    p->s.ptr = MMAPPED;
+    p->s.size = nunits;
+    return (void*)(p + 1);
+  }
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
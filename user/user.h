@@ -22,6 +22,21 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void* mmap(void*, uint, int, int, int, int);
+int munmap(void*, uint);
+int mprotect(void*, uint, int);
+int msync(void*, uint);
+int shmget(int, uint, int);
+void* shmat(int, void*, int);
+int shmdt(void*);
+int shmctl(int, int);
+int spawn(const char*, char**, int*, int);
+int vfork(void);
+int setpriority(int, int);
+int setscheduler(int, int, int);
+int setaffinity(int, uint64);
+int getaffinity(int, uint64*);
+int getcpu(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -4,6 +4,8 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/mman.h"
+#include "kernel/sched.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -786,6 +788,58 @@ pipe1(char *s)
 }
 
 
+// hold more pipes open, across processes, than the kernel's
+// fixed-size file table used to have room for.
+void
+manyfiles(char *s)
+{
+  enum { NCHILD = 16, NPIPE = 5 };
+  int ready[2], done[2], fds[2], pid, xstatus, i;
+  char c;
+
+  if(pipe(ready) < 0 || pipe(done) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork() failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(done[1]);
+      c = 'r';
+      for(int j = 0; j < NPIPE; j++){
+        if(pipe(fds) < 0 || write(fds[1], "x", 1) != 1 || read(fds[0], buf, 1) != 1){
+          c = 'f';
+          break;
+        }
+      }
+      write(ready[1], &c, 1);
+      // keep the pipes open until the parent closes done.
+      read(done[0], &c, 1);
+      exit(c == 'f');
+    }
+  }
+  close(ready[1]);
+  close(done[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1 || c != 'r'){
+      printf("%s: a child could not open its pipes\n", s);
+      exit(1);
+    }
+  }
+  close(ready[0]);
+  close(done[1]);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+}
+
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -2556,228 +2610,1461 @@ sbrk8000(char *s)
 
 
 
-// regression test. test whether exec() leaks memory if one of the
-// arguments is invalid. the test passes if the kernel doesn't panic.
-void
-badarg(char *s)
-{
-  for(int i = 0; i < 50000; i++){
-    char *argv[2];
-    argv[0] = (char*)0xffffffff;
-    argv[1] = 0;
-    exec("echo", argv);
-  }
-  
-  exit(0);
-}
-
-struct test {
-  void (*f)(char *);
-  char *s;
-} quicktests[] = {
-  {copyin, "copyin"},
-  {copyout, "copyout"},
-  {copyinstr1, "copyinstr1"},
-  {copyinstr2, "copyinstr2"},
-  {copyinstr3, "copyinstr3"},
-  {rwsbrk, "rwsbrk" },
-  {truncate1, "truncate1"},
-  {truncate2, "truncate2"},
-  {truncate3, "truncate3"},
-  {openiputtest, "openiput"},
-  {exitiputtest, "exitiput"},
-  {iputtest, "iput"},
-  {opentest, "opentest"},
-  {writetest, "writetest"},
-  {writebig, "writebig"},
-  {createtest, "createtest"},
-  {dirtest, "dirtest"},
-  {exectest, "exectest"},
-  {pipe1, "pipe1"},
-  {killstatus, "killstatus"},
-  {preempt, "preempt"},
-  {exitwait, "exitwait"},
-  {reparent, "reparent" },
-  {twochildren, "twochildren"},
-  {forkfork, "forkfork"},
-  {forkforkfork, "forkforkfork"},
-  {reparent2, "reparent2"},
-  {mem, "mem"},
-  {sharedfd, "sharedfd"},
-  {fourfiles, "fourfiles"},
-  {createdelete, "createdelete"},
-  {unlinkread, "unlinkread"},
-  {linktest, "linktest"},
-  {concreate, "concreate"},
-  {linkunlink, "linkunlink"},
-  {subdir, "subdir"},
-  {bigwrite, "bigwrite"},
-  {bigfile, "bigfile"},
-  {fourteen, "fourteen"},
-  {rmdot, "rmdot"},
-  {dirfile, "dirfile"},
-  {iref, "iref"},
-  {forktest, "forktest"},
-  {sbrkbasic, "sbrkbasic"},
-  {sbrkmuch, "sbrkmuch"},
-  {kernmem, "kernmem"},
-  {MAXVAplus, "MAXVAplus"},
-  {sbrkfail, "sbrkfail"},
-  {sbrkarg, "sbrkarg"},
-  {validatetest, "validatetest"},
-  {bsstest, "bsstest"},
-  {bigargtest, "bigargtest"},
-  {argptest, "argptest"},
-  {stacktest, "stacktest"},
-  {textwrite, "textwrite"},
-  {pgbug, "pgbug" },
-  {sbrkbugs, "sbrkbugs" },
-  {sbrklast, "sbrklast"},
-  {sbrk8000, "sbrk8000"},
-  {badarg, "badarg" },
-
-  { 0, 0},
-};
-
-//
-// Section with tests that take a fair bit of time
-//
-
-// directory that uses indirect blocks
+// fork() shares the parent's pages copy-on-write: writes
+// by the child, by the parent, and by the kernel on behalf of
+// either (read() into a shared page) must stay private.
 void
-bigdir(char *s)
+cowfork(char *s)
 {
-  enum { N = 500 };
-  int i, fd;
-  char name[10];
+  enum { SZ = 8*1024*1024 };
+  char *p, *q;
+  int i, pid, fd, xstatus;
 
-  unlink("bd");
-
-  fd = open("bd", O_CREATE);
-  if(fd < 0){
-    printf("%s: bigdir create failed\n", s);
+  p = sbrk(SZ);
+  if(p == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
     exit(1);
   }
-  close(fd);
+  for(i = 0; i < SZ; i += 4096)
+    p[i] = 'p';
 
-  for(i = 0; i < N; i++){
-    name[0] = 'x';
-    name[1] = '0' + (i / 64);
-    name[2] = '0' + (i % 64);
-    name[3] = '\0';
-    if(link("bd", name) != 0){
-      printf("%s: bigdir link(bd, %s) failed\n", s, name);
+  for(int c = 0; c < 3; c++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
       exit(1);
     }
+    if(pid == 0){
+      // copyout() into a copy-on-write page.
+      fd = open("README", 0);
+      if(fd < 0 || read(fd, p, 2) != 2){
+        printf("%s: read into cow page failed\n", s);
+        exit(1);
+      }
+      close(fd);
+      for(i = 4096; i < SZ; i += 4096){
+        if(p[i] != 'p'){
+          printf("%s: child saw %x at %d\n", s, p[i], i);
+          exit(1);
+        }
+        p[i] = 'a' + c;
+      }
+      for(i = 4096; i < SZ; i += 4096)
+        if(p[i] != 'a' + c)
+          exit(1);
+      exit(0);
+    }
   }
 
-  unlink("bd");
-  for(i = 0; i < N; i++){
-    name[0] = 'x';
-    name[1] = '0' + (i / 64);
-    name[2] = '0' + (i % 64);
-    name[3] = '\0';
-    if(unlink(name) != 0){
-      printf("%s: bigdir unlink failed", s);
+  for(int c = 0; c < 3; c++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+  for(q = p; q < p + SZ; q += 4096){
+    if(*q != 'p'){
+      printf("%s: parent page changed\n", s);
       exit(1);
     }
   }
+  sbrk(-SZ);
+  exit(0);
 }
 
-// concurrent writes to try to provoke deadlock in the virtio disk
-// driver.
+// sbrk() only reserves address space; pages appear, zeroed,
+// when first touched by the program or by a system call.
 void
-manywrites(char *s)
+lazysbrk(char *s)
 {
-  int nchildren = 4;
-  int howmany = 30; // increase to look for deadlock
-  
-  for(int ci = 0; ci < nchildren; ci++){
-    int pid = fork();
-    if(pid < 0){
-      printf("fork failed\n");
+  enum { BIG = 1024*1024*1024 };
+  char *a, *oldbrk;
+  int fd, fds[2];
+
+  oldbrk = sbrk(0);
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk of a 1 GB arena failed\n", s);
+    exit(1);
+  }
+  for(char *q = a; q < a + BIG; q += BIG/16){
+    if(*q != 0){
+      printf("%s: lazy page not zero\n", s);
       exit(1);
     }
+    *q = 1;
+  }
 
-    if(pid == 0){
-      char name[3];
-      name[0] = 'b';
-      name[1] = 'a' + ci;
-      name[2] = '\0';
-      unlink(name);
-      
-      for(int iters = 0; iters < howmany; iters++){
-        for(int i = 0; i < ci+1; i++){
-          int fd = open(name, O_CREATE | O_RDWR);
-          if(fd < 0){
-            printf("%s: cannot create %s\n", s, name);
-            exit(1);
-          }
-          int sz = sizeof(buf);
-          int cc = write(fd, buf, sz);
-          if(cc != sz){
-            printf("%s: write(%d) ret %d\n", s, sz, cc);
-            exit(1);
-          }
-          close(fd);
-        }
-        unlink(name);
-      }
-
-      unlink(name);
-      exit(0);
-    }
+  // copyout() into an untouched page.
+  fd = open("README", 0);
+  if(fd < 0 || read(fd, a + BIG - 8192, 10) != 10){
+    printf("%s: read into lazy page failed\n", s);
+    exit(1);
   }
+  close(fd);
 
-  for(int ci = 0; ci < nchildren; ci++){
-    int st = 0;
-    wait(&st);
-    if(st != 0)
-      exit(st);
+  // copyin() from an untouched page.
+  if(pipe(fds) != 0 || write(fds[1], a + BIG/2 + 4096, 8) != 8){
+    printf("%s: write from lazy page failed\n", s);
+    exit(1);
   }
+  close(fds[0]);
+  close(fds[1]);
+
+  sbrk(-(sbrk(0) - oldbrk));
   exit(0);
 }
 
-// regression test. does write() with an invalid buffer pointer cause
-// a block to be allocated for a file that is then not freed when the
-// file is deleted? if the kernel has this bug, it will panic: balloc:
-// out of blocks. assumed_free may need to be raised to be more than
-// the number of free blocks. this test takes a long time.
+// a large heap may be backed by 2 MiB megapages; make sure
+// copy-on-write and partial sbrk() shrinks still work one
+// 4 KiB page at a time.
 void
-badwrite(char *s)
+megapage(char *s)
 {
-  int assumed_free = 600;
-  
-  unlink("junk");
-  for(int i = 0; i < assumed_free; i++){
-    int fd = open("junk", O_CREATE|O_WRONLY);
-    if(fd < 0){
-      printf("open junk failed\n");
-      exit(1);
-    }
-    write(fd, (char*)0xffffffffffL, 1);
-    close(fd);
-    unlink("junk");
+  enum { MEG = 2*1024*1024 };
+  char *oldbrk, *a;
+  uint64 top;
+  int pid, xstatus;
+
+  oldbrk = sbrk(0);
+  top = ((uint64)oldbrk + 3*MEG) & ~(uint64)(MEG-1);
+  if(sbrk(top - (uint64)oldbrk) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
   }
+  a = (char*)(top - MEG);
+  for(int i = 0; i < MEG; i += 4096)
+    a[i] = i / 4096;
 
-  int fd = open("junk", O_CREATE|O_WRONLY);
-  if(fd < 0){
-    printf("open junk failed\n");
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
     exit(1);
   }
-  if(write(fd, "x", 1) != 1){
-    printf("write failed\n");
+  if(pid == 0){
+    a[4096] = 'c';
+    for(int i = 2*4096; i < MEG; i += 4096)
+      if(a[i] != (char)(i / 4096))
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[4096] != 1){
+    printf("%s: copy-on-write of a megapage failed\n", s);
     exit(1);
   }
-  close(fd);
-  unlink("junk");
 
+  // drop the last page of the megapage.
+  sbrk(-4096);
+  for(int i = 0; i < MEG - 4096; i += 4096){
+    if(a[i] != (char)(i / 4096)){
+      printf("%s: lost data after partial shrink\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-(sbrk(0) - oldbrk));
   exit(0);
 }
 
-// test the exec() code that cleans up if it runs out
-// of memory. it's really a test that such a condition
-// doesn't cause a panic.
+// initialized data that nothing touches before execdata() runs,
+// so that its pages have yet to be read in from the program file.
+char execbuf[6*4096] = { 'x', [3*4096] = 'y' };
+int execstatus = -1;
+
+// the kernel reads a program's pages in on first use, including
+// when write(), read() and wait() are the first to use them.
+void
+execdata(char *s)
+{
+  int fds[2], pid;
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], &execbuf[3*4096], 1) != 1){
+    printf("%s: write from unread data failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], &execbuf[5*4096], 1) != 1){
+    printf("%s: read into unread data failed\n", s);
+    exit(1);
+  }
+  if(execbuf[0] != 'x' || execbuf[5*4096] != 'y' || execbuf[4*4096] != 0){
+    printf("%s: wrong initialized data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(execbuf[3*4096] == 'y' ? 7 : 1);
+  if(wait(&execstatus) != pid || execstatus != 7){
+    printf("%s: wait status %d, not 7\n", s, execstatus);
+    exit(1);
+  }
+  exit(0);
+}
+
+// run the program te with stdout sent to the file teout, and
+// return its exit status.
+static int
+texterun(char *s)
+{
+  char *args[] = { "te", "hello", 0 };
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    if(open("teout", O_CREATE|O_TRUNC|O_WRONLY) != 1)
+      exit(1);
+    exec("te", args);
+    exit(1);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+// the text pages of a program are shared between processes
+// through a cache; writing the program file must invalidate
+// it, so that the next run sees the new contents.
+void
+textinval(char *s)
+{
+  char buf[512];
+  int fd, tfd, n, size;
+
+  if((fd = open("echo", O_RDONLY)) < 0){
+    printf("%s: open echo failed\n", s);
+    exit(1);
+  }
+  if((tfd = open("te", O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    printf("%s: create te failed\n", s);
+    exit(1);
+  }
+  size = 0;
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    if(write(tfd, buf, n) != n){
+      printf("%s: write te failed\n", s);
+      exit(1);
+    }
+    size += n;
+  }
+  close(fd);
+  close(tfd);
+
+  for(int i = 0; i < 2; i++){
+    if(texterun(s) != 0){
+      printf("%s: te failed\n", s);
+      exit(1);
+    }
+  }
+  fd = open("teout", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if(n != 6 || memcmp(buf, "hello\n", 6) != 0){
+    printf("%s: te wrote the wrong output\n", s);
+    exit(1);
+  }
+
+  // keep the ELF headers but zero everything after them,
+  // code included.
+  fd = open("echo", O_RDONLY);
+  tfd = open("te", O_WRONLY);
+  if(fd < 0 || tfd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf) ||
+     write(tfd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: rewrite te failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  memset(buf, 0, sizeof(buf));
+  for(n = sizeof(buf); n < size; n += sizeof(buf)){
+    if(write(tfd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: rewrite te failed\n", s);
+      exit(1);
+    }
+  }
+  close(tfd);
+
+  if(texterun(s) == 0){
+    printf("%s: ran stale text after the program was rewritten\n", s);
+    exit(1);
+  }
+  unlink("te");
+  unlink("teout");
+  exit(0);
+}
+
+// fork a child that writes to *p, and return its exit status.
+static int
+mmapwrite(char *s, char *p)
+{
+  int pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    *p = 'w';
+    exit(0);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+// copyin() and copyout() to and from pages that are not
+// there yet, copy-on-write, or read-only, which the kernel's
+// direct copy must leave to its page-at-a-time fallback.
+void
+usercopy(char *s)
+{
+  char *p, *q;
+  int fd, pid, xstatus;
+
+  p = mmap(0, 4*4096, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+  if(p == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 4*4096; i++)
+    p[i] = i * 7;
+  unlink("usercopy");
+  fd = open("usercopy", O_CREATE|O_WRONLY);
+  if(fd < 0 || write(fd, p, 4*4096) != 4*4096){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // into untouched heap pages.
+  q = sbrk(4*4096);
+  if(q == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  fd = open("usercopy", O_RDONLY);
+  if(fd < 0 || read(fd, q, 4*4096) != 4*4096 || memcmp(p, q, 4*4096) != 0){
+    printf("%s: read into new pages failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // into pages the child shares copy-on-write.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    fd = open("usercopy", O_RDONLY);
+    if(fd < 0 || read(fd, q + 100, 3*4096) != 3*4096 || memcmp(p, q + 100, 3*4096) != 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || memcmp(p, q, 4*4096) != 0){
+    printf("%s: read into copy-on-write pages failed\n", s);
+    exit(1);
+  }
+
+  // into a read-only page, part way through.
+  if(mprotect(p + 2*4096, 4096, PROT_READ) != 0){
+    printf("%s: mprotect failed\n", s);
+    exit(1);
+  }
+  fd = open("usercopy", O_RDONLY);
+  if(fd < 0 || read(fd, p + 4096, 2*4096) == 2*4096){
+    printf("%s: read into a read-only page succeeded\n", s);
+    exit(1);
+  }
+
+  close(fd);
+
+  // out of pages the user cannot read.
+  if(mprotect(p, 4096, PROT_NONE) != 0){
+    printf("%s: mprotect failed\n", s);
+    exit(1);
+  }
+  fd = open("usercopy", O_WRONLY);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(write(fd, p, 4096) != -1){
+    printf("%s: write from a PROT_NONE page succeeded\n", s);
+    exit(1);
+  }
+  if(write(fd, (char*)PGROUNDDOWN(r_sp()) - 4096, 4096) != -1){
+    printf("%s: write from the stack guard page succeeded\n", s);
+    exit(1);
+  }
+
+  close(fd);
+  unlink("usercopy");
+  munmap(p, 4*4096);
+  sbrk(-4*4096);
+}
+
+// a read() from a pipe into a page that faults takes
+// nothing out of the pipe, and a write() from one stops
+// just short of it.
+void
+pipefault(char *s)
+{
+  char buf[300], *p;
+  int fds[2];
+
+  p = mmap(0, 4096, PROT_NONE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+  if(p == MAP_FAILED || pipe(fds) < 0){
+    printf("%s: mmap or pipe failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < sizeof(buf); i++)
+    buf[i] = i;
+  if(write(fds[1], buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: pipe write failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], p, sizeof(buf)) > 0){
+    printf("%s: pipe read into a PROT_NONE page succeeded\n", s);
+    exit(1);
+  }
+  memset(buf, 0, sizeof(buf));
+  if(read(fds[0], buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: pipe lost data to a failed read\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < sizeof(buf); i++){
+    if(buf[i] != (char)i){
+      printf("%s: pipe data wrong after a failed read\n", s);
+      exit(1);
+    }
+  }
+  munmap(p, 4096);
+
+  // a write() from a buffer that runs into such a page
+  // writes everything before it.
+  p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+  if(p == MAP_FAILED || mprotect(p + 4096, 4096, PROT_NONE) != 0){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  memset(p, 'w', 4096);
+  if(write(fds[1], p + 4096 - 100, 200) != 100){
+    printf("%s: pipe write did not stop at the fault\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, sizeof(buf)) != 100 || buf[0] != 'w' || buf[99] != 'w'){
+    printf("%s: pipe write lost the bytes before the fault\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  munmap(p, 2*4096);
+}
+
+// spin until uptime() reaches end, then send the parent
+// the number of times round the loop through fd.
+static void
+spinuntil(int end, int fd)
+{
+  uint64 n = 0;
+
+  while(uptime() < end)
+    n++;
+  if(write(fd, &n, sizeof(n)) != sizeof(n))
+    exit(1);
+  exit(0);
+}
+
+// setpriority() checks its arguments, and of two spinners
+// sharing a CPU, the one at nice 0 gets several times the
+// share of the one at nice 10 under SCHED_FAIR, and about
+// the same under SCHED_RR.
+void
+setprio(char *s)
+{
+  int fds[2][2], pid, end, xstatus;
+  uint64 all, n[2];
+
+  if(setpriority(0, 20) != -1 || setpriority(0, -21) != -1){
+    printf("%s: setpriority accepted a bad nice value\n", s);
+    exit(1);
+  }
+  if(setpriority(0x7fffffff, 0) != -1){
+    printf("%s: setpriority accepted a bad pid\n", s);
+    exit(1);
+  }
+
+  if(getaffinity(0, &all) != 0 || setaffinity(0, 1) != 0){
+    printf("%s: setaffinity failed\n", s);
+    exit(1);
+  }
+  end = uptime() + 20;
+  for(int i = 0; i < 2; i++){
+    if(pipe(fds[i]) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      if(setpriority(0, 10*i) != 0)
+        exit(1);
+      spinuntil(end, fds[i][1]);
+    }
+  }
+  setaffinity(0, all);
+  for(int i = 0; i < 2; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: spinner failed\n", s);
+      exit(1);
+    }
+  }
+  for(int i = 0; i < 2; i++){
+    if(read(fds[i][0], &n[i], sizeof(n[i])) != sizeof(n[i])){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+    close(fds[i][0]);
+    close(fds[i][1]);
+  }
+
+#if SCHEDPOLICY == SCHED_FAIR
+  // weights 1024 and 110.
+  if(n[0] < 4*n[1]){
+#else
+  if(n[0] > 2*n[1] || n[1] > 2*n[0]){
+#endif
+    printf("%s: spinners at nice 0 and 10 went round %l and %l times\n",
+           s, n[0], n[1]);
+    exit(1);
+  }
+}
+
+// setscheduler() checks its arguments; a real-time process
+// keeps a CPU-bound SCHED_OTHER one off its CPU; and a
+// real-time process waiting for a sleep-lock lends its
+// priority to the SCHED_OTHER holder, so that one of middle
+// priority on the holder's CPU cannot hold it up.
+void
+setsched(char *s)
+{
+  enum { N = 100*1024 };
+  volatile uint64 *shared;
+  uint64 before;
+  int id, fd, fds[2], pid, hpid, t, xstatus;
+  char *buf;
+
+  if(setscheduler(0, SCHED_OTHER, 1) != -1 ||
+     setscheduler(0, SCHED_RTFIFO, 0) != -1 ||
+     setscheduler(0, SCHED_RTRR, RTPRIOMAX+1) != -1 ||
+     setscheduler(0, 3, 1) != -1){
+    printf("%s: setscheduler accepted bad arguments\n", s);
+    exit(1);
+  }
+  if(setscheduler(0x7fffffff, SCHED_RTFIFO, 1) != -1){
+    printf("%s: setscheduler accepted a bad pid\n", s);
+    exit(1);
+  }
+
+  // a spinner on CPU 0 counts in shared[0] until shared[1]
+  // is set; while a real-time process runs there, it gets
+  // nowhere.
+  id = shmget(IPC_PRIVATE, 4096, IPC_CREAT);
+  if(id < 0 || (shared = shmat(id, 0, 0)) == MAP_FAILED){
+    printf("%s: shmget failed\n", s);
+    exit(1);
+  }
+  shmctl(id, IPC_RMID);
+  shared[0] = shared[1] = 0;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(setaffinity(0, 1) != 0)
+      exit(1);
+    while(shared[1] == 0)
+      shared[0]++;
+    exit(0);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(setaffinity(0, 1) != 0 || setscheduler(0, SCHED_RTFIFO, 10) != 0)
+      exit(1);
+    sleep(2);
+    before = shared[0];
+    t = uptime();
+    while(uptime() < t + 5)
+      ;
+    xstatus = before == 0 || shared[0] != before;
+    shared[1] = 1;
+    exit(xstatus);
+  }
+  for(int i = 0; i < 2; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: spinner ran while a real-time process had its CPU\n", s);
+      exit(1);
+    }
+  }
+  shmdt((void*)shared);
+
+  // a file bigger than the buffer cache, so that reading it
+  // sleeps for the disk with the inode locked.
+  buf = malloc(N);
+  if(buf == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  fd = open("setsched", O_CREATE|O_TRUNC|O_RDWR);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: write setsched failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  // the holder reads the whole file on CPU 0, with a
+  // real-time spinner of priority 10 there as well.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(setaffinity(0, 1) != 0 || (fd = open("setsched", O_RDONLY)) < 0)
+      exit(1);
+    write(fds[1], "x", 1);
+    if(read(fd, buf, N) != N)
+      exit(1);
+    exit(0);
+  }
+  read(fds[0], buf, 1);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(setaffinity(0, 1) != 0 || setscheduler(0, SCHED_RTFIFO, 10) != 0)
+      exit(1);
+    t = uptime();
+    while(uptime() < t + 30)
+      ;
+    exit(0);
+  }
+
+  // a priority 20 process that wants the inode should wait
+  // only for the holder's read, not for the spinner.
+  sleep(1);
+  hpid = fork();
+  if(hpid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(hpid == 0){
+    if(setaffinity(0, 1) != 0 || setscheduler(0, SCHED_RTFIFO, 20) != 0)
+      exit(-1);
+    t = uptime();
+    if((fd = open("setsched", O_RDONLY)) < 0 || read(fd, buf, 1) != 1)
+      exit(-1);
+    exit(uptime() - t);
+  }
+  for(int i = 0; i < 3; i++){
+    pid = wait(&xstatus);
+    if(pid == hpid && (xstatus < 0 || xstatus >= 15)){
+      printf("%s: waited %d ticks for a sleep-lock\n", s, xstatus);
+      exit(1);
+    }
+    if(pid != hpid && xstatus != 0){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("setsched");
+  free(buf);
+}
+
+// setaffinity() and getaffinity(); a child inherits its
+// parent's affinity mask; and a process pinned to one CPU
+// runs only there, however busy the other CPUs are.
+void
+affinity(char *s)
+{
+  uint64 all, mask;
+  int cpu, pid, end, xstatus;
+
+  if(getaffinity(0, &all) != 0 || all == 0){
+    printf("%s: getaffinity failed\n", s);
+    exit(1);
+  }
+  if(setaffinity(0, 0) != -1 || setaffinity(0x7fffffff, all) != -1){
+    printf("%s: setaffinity accepted bad arguments\n", s);
+    exit(1);
+  }
+
+  // the highest running CPU, where the scheduler would
+  // least often put a process by itself.
+  for(cpu = 63; (all & (1L << cpu)) == 0; cpu--)
+    ;
+  if(setaffinity(0, 1L << cpu) != 0 || getaffinity(0, &mask) != 0 ||
+     mask != 1L << cpu || getcpu() != cpu){
+    printf("%s: setaffinity to CPU %d failed\n", s, cpu);
+    exit(1);
+  }
+  end = uptime() + 10;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // be preempted and picked to run again, on cpu only.
+    while(uptime() < end)
+      if(getcpu() != cpu)
+        exit(1);
+    exit(0);
+  }
+  if(getaffinity(pid, &mask) != 0 || mask != 1L << cpu){
+    printf("%s: child did not inherit the mask\n", s);
+    exit(1);
+  }
+  if(setaffinity(0, all) != 0){
+    printf("%s: setaffinity back failed\n", s);
+    exit(1);
+  }
+
+  // unpinned spinners, to keep every CPU busy and give
+  // the others reason to steal.
+  for(int i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      while(uptime() < end)
+        ;
+      exit(0);
+    }
+  }
+  for(int i = 0; i < 5; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: pinned process ran on a CPU other than %d\n", s, cpu);
+      exit(1);
+    }
+  }
+}
+
+// anonymous mmap(), munmap() and mprotect().
+void
+mmapanon(char *s)
+{
+  char *p, *q;
+
+  p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+  if(p == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if((uint64)p < (uint64)sbrk(0)){
+    printf("%s: mmap returned %p, inside the heap\n", s, p);
+    exit(1);
+  }
+  for(int i = 0; i < 3*4096; i++){
+    if(p[i] != 0){
+      printf("%s: mmap memory not zero\n", s);
+      exit(1);
+    }
+    p[i] = i;
+  }
+
+  // the child gets a copy-on-write copy.
+  if(mmapwrite(s, p + 4096) != 0 || p[4096] != (char)4096){
+    printf("%s: fork of an mmap region failed\n", s);
+    exit(1);
+  }
+
+  // unmap the middle page.
+  if(munmap(p + 4096, 4096) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if(mmapwrite(s, p + 4096) != -1){
+    printf("%s: write to an unmapped page succeeded\n", s);
+    exit(1);
+  }
+  if(p[0] != 0 || p[2*4096+1] != 1){
+    printf("%s: munmap lost neighbouring data\n", s);
+    exit(1);
+  }
+
+  // make the first page read-only.
+  if(mprotect(p, 4096, PROT_READ) != 0){
+    printf("%s: mprotect failed\n", s);
+    exit(1);
+  }
+  if(mmapwrite(s, p) != -1){
+    printf("%s: write to a read-only page succeeded\n", s);
+    exit(1);
+  }
+  if(mprotect(p + 4096, 4096, PROT_READ) != -1){
+    printf("%s: mprotect of an unmapped page succeeded\n", s);
+    exit(1);
+  }
+  if(mprotect(p, 4096, PROT_READ|PROT_WRITE) != 0){
+    printf("%s: mprotect failed\n", s);
+    exit(1);
+  }
+  p[0] = 'x';
+  munmap(p, 3*4096);
+
+  // large malloc() blocks go back to the kernel.
+  for(int i = 0; i < 100; i++){
+    if((q = malloc(1024*1024)) == 0){
+      printf("%s: malloc failed\n", s);
+      exit(1);
+    }
+    q[0] = q[1024*1024-1] = 'm';
+    free(q);
+  }
+  exit(0);
+}
+
+// file-backed mmap(), shared and private.
+void
+mmapfile(char *s)
+{
+  enum { SZ = 3*4096 + 100 };
+  char *p, *q;
+  char buf[64];
+  int fd, pid, xstatus;
+
+  fd = open("mmapf", O_CREATE|O_TRUNC|O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmapf failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < SZ; i++){
+    buf[0] = 'a' + i % 26;
+    if(write(fd, buf, 1) != 1){
+      printf("%s: write mmapf failed\n", s);
+      exit(1);
+    }
+  }
+
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  q = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED || q == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < SZ; i++){
+    if(p[i] != 'a' + i % 26 || q[i] != 'a' + i % 26){
+      printf("%s: mapped file has the wrong contents\n", s);
+      exit(1);
+    }
+  }
+  if(p[SZ] != 0){
+    printf("%s: not zero beyond the end of the file\n", s);
+    exit(1);
+  }
+
+  // a private mapping's writes stay private.
+  q[0] = 'Q';
+  if(p[0] != 'a'){
+    printf("%s: private write reached the shared mapping\n", s);
+    exit(1);
+  }
+
+  // a shared mapping sees a forked child's writes.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[1] = 'C';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[1] != 'C'){
+    printf("%s: shared mapping missed the child's write\n", s);
+    exit(1);
+  }
+
+  // and write() to the file shows up in the mapping.
+  close(fd);
+  fd = open("mmapf", O_WRONLY);
+  if(write(fd, "W", 1) != 1 || p[0] != 'W'){
+    printf("%s: shared mapping missed write()\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  p[4096] = 'S';
+  if(msync(p, SZ) != 0 || munmap(p, SZ) != 0 || munmap(q, SZ) != 0){
+    printf("%s: msync or munmap failed\n", s);
+    exit(1);
+  }
+  fd = open("mmapf", O_RDONLY);
+  if(read(fd, buf, 2) != 2 || buf[0] != 'W' || buf[1] != 'C'){
+    printf("%s: changes did not reach the file\n", s);
+    exit(1);
+  }
+  p = mmap(0, SZ, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED || p[4096] != 'S'){
+    printf("%s: changes did not reach the file\n", s);
+    exit(1);
+  }
+  if(mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED){
+    printf("%s: writable shared mapping of a read-only file\n", s);
+    exit(1);
+  }
+  if(mprotect(p, SZ, PROT_READ|PROT_WRITE) != -1){
+    printf("%s: made a shared mapping of a read-only file writable\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapf");
+  exit(0);
+}
+
+// read() and write() of a file to and from an untouched
+// private mapping of the same file, whose pages must be read
+// in from the file while the copy would hold its buffers.
+void
+mmapselfread(char *s)
+{
+  enum { SZ = 2*4096 };
+  char *p, *q;
+  int fd;
+
+  fd = open("mmapself", O_CREATE|O_TRUNC|O_RDWR);
+  if(fd < 0){
+    printf("%s: create mmapself failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < SZ; i++){
+    if(write(fd, i % 2 ? "o" : "e", 1) != 1){
+      printf("%s: write mmapself failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("mmapself", O_RDWR);
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  q = mmap(0, SZ, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED || q == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(read(fd, p, SZ) != SZ){
+    printf("%s: read into the mapping failed\n", s);
+    exit(1);
+  }
+  if(write(fd, q, SZ) != SZ){
+    printf("%s: write from the mapping failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < SZ; i++){
+    if(p[i] != (i % 2 ? 'o' : 'e')){
+      printf("%s: read the wrong contents\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("mmapself");
+  exit(0);
+}
+
+// a shared mapping of more pages than the page cache keeps
+// text pages, and a truncation of the file while it is
+// mapped, which must leave every mapping on the same pages.
+void
+mmapsharedmany(char *s)
+{
+  enum { SZ = (NTEXTPAGE + 100) * 4096 };
+  char *p, *q;
+  int fd;
+
+  fd = open("mmapmany", O_CREATE|O_TRUNC|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf("%s: create mmapmany failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < SZ; i += 4096){
+    if(p[i] != (i == 0 ? 'x' : 0)){
+      printf("%s: mapped file has the wrong contents\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("mmapmany", O_TRUNC|O_RDWR);
+  if(fd < 0 || p[0] != 0){
+    printf("%s: truncation did not reach the mapping\n", s);
+    exit(1);
+  }
+  p[0] = 'T';
+  q = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(q == MAP_FAILED || q[0] != 'T'){
+    printf("%s: a new mapping got a different page\n", s);
+    exit(1);
+  }
+  munmap(q, 4096);
+  munmap(p, SZ);
+  close(fd);
+  unlink("mmapmany");
+  exit(0);
+}
+
+// System V-style shared memory between a parent and child.
+void
+shmipc(char *s)
+{
+  int id, id2, pid, xstatus;
+  char *p, *q;
+
+  id = shmget(IPC_PRIVATE, 3*4096, IPC_CREAT);
+  if(id < 0){
+    printf("%s: shmget failed\n", s);
+    exit(1);
+  }
+  p = shmat(id, 0, 0);
+  if(p == MAP_FAILED){
+    printf("%s: shmat failed\n", s);
+    exit(1);
+  }
+  p[0] = 'p';
+
+  // the child inherits the attachment, and attaches again
+  // by key.
+  id2 = shmget(0x5348, 4096, IPC_CREAT);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(p[0] != 'p')
+      exit(1);
+    p[1] = 'c';
+    p[2*4096] = 'C';
+    q = shmat(shmget(0x5348, 4096, 0), 0, 0);
+    if(q == MAP_FAILED)
+      exit(1);
+    q[0] = 'k';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[1] != 'c' || p[2*4096] != 'C'){
+    printf("%s: parent missed the child's writes\n", s);
+    exit(1);
+  }
+  q = shmat(id2, 0, SHM_RDONLY);
+  if(q == MAP_FAILED || q[0] != 'k'){
+    printf("%s: shmat by key failed\n", s);
+    exit(1);
+  }
+  if(mmapwrite(s, q) != -1){
+    printf("%s: wrote to a read-only attachment\n", s);
+    exit(1);
+  }
+  if(mprotect(q, 4096, PROT_READ|PROT_WRITE) != -1){
+    printf("%s: made a read-only attachment writable\n", s);
+    exit(1);
+  }
+
+  if(shmctl(id, IPC_RMID) != 0 || shmctl(id2, IPC_RMID) != 0){
+    printf("%s: shmctl failed\n", s);
+    exit(1);
+  }
+  // still attached; still usable.
+  p[3] = 'x';
+  if(shmdt(p) != 0 || shmdt(q) != 0 || shmdt(p) != -1){
+    printf("%s: shmdt failed\n", s);
+    exit(1);
+  }
+  if(shmat(id, 0, 0) != MAP_FAILED){
+    printf("%s: attached a removed segment\n", s);
+    exit(1);
+  }
+  exit(0);
+}
+
+// spawn() with the child's output redirected to a file.
+void
+spawntest(char *s)
+{
+  int fd, pid, xstatus, fds[3];
+  char *echoargv[] = { "echo", "spawned", 0 };
+  char buf[8];
+
+  unlink("spawn-out");
+  fd = open("spawn-out", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fds[0] = -1;
+  fds[1] = fd;
+  fds[2] = 2;
+  pid = spawn("echo", echoargv, fds, 3);
+  close(fd);
+  if(pid < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  if(spawn("nosuchprogram", echoargv, 0, 0) != -1){
+    printf("%s: spawned a missing program\n", s);
+    exit(1);
+  }
+  fds[1] = NOFILE;
+  if(spawn("echo", echoargv, fds, 3) != -1){
+    printf("%s: spawn with a bad fd succeeded\n", s);
+    exit(1);
+  }
+
+  fd = open("spawn-out", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 8) != 8 || memcmp(buf, "spawned\n", 8) != 0){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spawn-out");
+  exit(0);
+}
+
+int vforkval;
+
+// a vfork() child runs in its parent's memory until it
+// exits or execs.
+void
+vforktest(char *s)
+{
+  int pid, xstatus;
+  char *top;
+  char *echoargv[] = { "echo", "OK", 0 };
+
+  vforkval = 1;
+  top = sbrk(0);
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    vforkval = 2;
+    sbrk(4096);
+    exit(0);
+  }
+  if(vforkval != 2 || sbrk(0) != top + 4096){
+    printf("%s: parent missed the child's changes\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    open("vfork-out", O_CREATE|O_WRONLY);
+    exec("echo", echoargv);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: exec in the child failed\n", s);
+    exit(1);
+  }
+  unlink("vfork-out");
+  exit(0);
+}
+
+// regression test. test whether exec() leaks memory if one of the
+// arguments is invalid. the test passes if the kernel doesn't panic.
+void
+badarg(char *s)
+{
+  for(int i = 0; i < 50000; i++){
+    char *argv[2];
+    argv[0] = (char*)0xffffffff;
+    argv[1] = 0;
+    exec("echo", argv);
+  }
+  
+  exit(0);
+}
+
+struct test {
+  void (*f)(char *);
+  char *s;
+} quicktests[] = {
+  {copyin, "copyin"},
+  {copyout, "copyout"},
+  {copyinstr1, "copyinstr1"},
+  {copyinstr2, "copyinstr2"},
+  {copyinstr3, "copyinstr3"},
+  {rwsbrk, "rwsbrk" },
+  {truncate1, "truncate1"},
+  {truncate2, "truncate2"},
+  {truncate3, "truncate3"},
+  {openiputtest, "openiput"},
+  {exitiputtest, "exitiput"},
+  {iputtest, "iput"},
+  {opentest, "opentest"},
+  {writetest, "writetest"},
+  {writebig, "writebig"},
+  {createtest, "createtest"},
+  {dirtest, "dirtest"},
+  {exectest, "exectest"},
+  {pipe1, "pipe1"},
+  {manyfiles, "manyfiles"},
+  {usercopy, "usercopy"},
+  {pipefault, "pipefault"},
+  {setprio, "setpriority"},
+  {setsched, "setscheduler"},
+  {affinity, "affinity"},
+  {killstatus, "killstatus"},
+  {preempt, "preempt"},
+  {exitwait, "exitwait"},
+  {reparent, "reparent" },
+  {twochildren, "twochildren"},
+  {forkfork, "forkfork"},
+  {forkforkfork, "forkforkfork"},
+  {reparent2, "reparent2"},
+  {mem, "mem"},
+  {sharedfd, "sharedfd"},
+  {fourfiles, "fourfiles"},
+  {createdelete, "createdelete"},
+  {unlinkread, "unlinkread"},
+  {linktest, "linktest"},
+  {concreate, "concreate"},
+  {linkunlink, "linkunlink"},
+  {subdir, "subdir"},
+  {bigwrite, "bigwrite"},
+  {bigfile, "bigfile"},
+  {fourteen, "fourteen"},
+  {rmdot, "rmdot"},
+  {dirfile, "dirfile"},
+  {iref, "iref"},
+  {forktest, "forktest"},
+  {cowfork, "cowfork"},
+  {lazysbrk, "lazysbrk"},
+  {megapage, "megapage"},
+  {execdata, "execdata"},
+  {textinval, "textinval"},
+  {mmapanon, "mmapanon"},
+  {mmapfile, "mmapfile"},
+  {mmapselfread, "mmapselfread"},
+  {mmapsharedmany, "mmapsharedmany"},
+  {shmipc, "shmipc"},
+  {spawntest, "spawntest"},
+  {vforktest, "vforktest"},
+  {sbrkbasic, "sbrkbasic"},
+  {sbrkmuch, "sbrkmuch"},
+  {kernmem, "kernmem"},
+  {MAXVAplus, "MAXVAplus"},
+  {sbrkfail, "sbrkfail"},
+  {sbrkarg, "sbrkarg"},
+  {validatetest, "validatetest"},
+  {bsstest, "bsstest"},
+  {bigargtest, "bigargtest"},
+  {argptest, "argptest"},
+  {stacktest, "stacktest"},
+  {textwrite, "textwrite"},
+  {pgbug, "pgbug" },
+  {sbrkbugs, "sbrkbugs" },
+  {sbrklast, "sbrklast"},
+  {sbrk8000, "sbrk8000"},
+  {badarg, "badarg" },
+
+  { 0, 0},
+};
+
+//
+// Section with tests that take a fair bit of time
+//
+
+// directory that uses indirect blocks
+void
+bigdir(char *s)
+{
+  enum { N = 500 };
+  int i, fd;
+  char name[10];
+
+  unlink("bd");
+
+  fd = open("bd", O_CREATE);
+  if(fd < 0){
+    printf("%s: bigdir create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[0] = 'x';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if(link("bd", name) != 0){
+      printf("%s: bigdir link(bd, %s) failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  unlink("bd");
+  for(i = 0; i < N; i++){
+    name[0] = 'x';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if(unlink(name) != 0){
+      printf("%s: bigdir unlink failed", s);
+      exit(1);
+    }
+  }
+}
+
+// concurrent writes to try to provoke deadlock in the virtio disk
+// driver.
+void
+manywrites(char *s)
+{
+  int nchildren = 4;
+  int howmany = 30; // increase to look for deadlock
+  
+  for(int ci = 0; ci < nchildren; ci++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    }
+
+    if(pid == 0){
+      char name[3];
+      name[0] = 'b';
+      name[1] = 'a' + ci;
+      name[2] = '\0';
+      unlink(name);
+      
+      for(int iters = 0; iters < howmany; iters++){
+        for(int i = 0; i < ci+1; i++){
+          int fd = open(name, O_CREATE | O_RDWR);
+          if(fd < 0){
+            printf("%s: cannot create %s\n", s, name);
+            exit(1);
+          }
+          int sz = sizeof(buf);
+          int cc = write(fd, buf, sz);
+          if(cc != sz){
+            printf("%s: write(%d) ret %d\n", s, sz, cc);
+            exit(1);
+          }
+          close(fd);
+        }
+        unlink(name);
+      }
+
+      unlink(name);
+      exit(0);
+    }
+  }
+
+  for(int ci = 0; ci < nchildren; ci++){
+    int st = 0;
+    wait(&st);
+    if(st != 0)
+      exit(st);
+  }
+  exit(0);
+}
+
+// regression test. does write() with an invalid buffer pointer cause
+// a block to be allocated for a file that is then not freed when the
+// file is deleted? if the kernel has this bug, it will panic: balloc:
+// out of blocks. assumed_free may need to be raised to be more than
+// the number of free blocks. this test takes a long time.
+void
+badwrite(char *s)
+{
+  int assumed_free = 600;
+  
+  unlink("junk");
+  for(int i = 0; i < assumed_free; i++){
+    int fd = open("junk", O_CREATE|O_WRONLY);
+    if(fd < 0){
+      printf("open junk failed\n");
+      exit(1);
+    }
+    write(fd, (char*)0xffffffffffL, 1);
+    close(fd);
+    unlink("junk");
+  }
+
+  int fd = open("junk", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("open junk failed\n");
+    exit(1);
+  }
+  if(write(fd, "x", 1) != 1){
+    printf("write failed\n");
+    exit(1);
+  }
+  close(fd);
+  unlink("junk");
+
+  exit(0);
+}
+
+// test the exec() code that cleans up if it runs out
+// of memory. it's really a test that such a condition
+// doesn't cause a panic.
 void
 execout(char *s)
 {
@@ -2924,6 +4211,60 @@ outofinodes(char *s)
   }
 }
 
+// touch more memory than the machine has, so that some of it
+// must be swapped out, and check that every page reads back
+// what was written to it. Odd pages are random, so that they
+// go to the swap disk rather than compressed into memory.
+void
+swaptest(char *s)
+{
+  int npages = 132 * 1024 * 1024 / PGSIZE; // more than the 128 MiB of RAM
+  int pid, xstatus;
+  char *base, *a;
+  uint x;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // grow a page at a time, so the heap gets no megapages.
+    base = sbrk(0);
+    for(int i = 0; i < npages; i++){
+      a = sbrk(PGSIZE);
+      *(int*)a = i;
+      a[PGSIZE-1] = i;
+      x = i + 1;
+      for(int j = 4; i % 2 == 1 && j < PGSIZE - 4; j += 4){
+        x = x * 1103515245 + 12345;
+        *(uint*)(a + j) = x;
+      }
+    }
+    for(int i = 0; i < npages; i++){
+      a = base + (uint64)i * PGSIZE;
+      if(*(int*)a != i || a[PGSIZE-1] != (char)i){
+        printf("%s: page %d has the wrong contents\n", s, i);
+        exit(1);
+      }
+      x = i + 1;
+      for(int j = 4; i % 2 == 1 && j < PGSIZE - 4; j += 4){
+        x = x * 1103515245 + 12345;
+        if(*(uint*)(a + j) != x){
+          printf("%s: page %d has the wrong contents\n", s, i);
+          exit(1);
+        }
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: failed, is there a swap disk?\n", s);
+    exit(1);
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2931,6 +4272,7 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {swaptest, "swaptest"},
     
   { 0, 0},
 };
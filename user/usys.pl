@@ -36,3 +36,18 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("mprotect");
+entry("msync");
+entry("shmget");
+entry("shmat");
+entry("shmdt");
+entry("shmctl");
+entry("spawn");
+entry("vfork");
+entry("setpriority");
+entry("setscheduler");
+entry("setaffinity");
+entry("getaffinity");
+entry("getcpu");